@@ -0,0 +1,683 @@
+/* A headless benchmark of the subdivision core.
+ *
+ * Times the calls behind ofxButterfly's subdivideButterfly, subdivideLinear, subdividePascal and subdivideBoundary,
+ * the topology_start, topology_subdivide_* and topology_end pipeline and fixMesh, at every level,
+ * for the bundled PLY meshes and for synthetic meshes of growing size. The results are written as JSON.
+ *
+ *   butterfly_benchmark [--data DIR] [--levels MIN-MAX] [--repeat N] [--threads N]
+ *                       [--max-triangles N] [--output FILE]
+ *
+ * Every case runs once to warm up and then repeat times on the same Subdivider, like an application that
+ * subdivides again on every edit. time_ms is the median of the repetitions, cold_ms the warm up run.
+ * peak_heap_bytes is the highest heap use of the case above the heap use before it.
+ */
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include "subdivider.hpp"
+#include "error.hpp"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#ifndef BUTTERFLY_DATA_DIR
+#define BUTTERFLY_DATA_DIR "example/bin/data"
+#endif
+
+// -- Heap accounting. Every allocation is prefixed with its size, so the bytes in use are known at all times.
+
+static std::atomic<size_t> heap_bytes(0);
+static std::atomic<size_t> heap_peak(0);
+
+// Keeps the blocks aligned for any fundamental type.
+static const size_t HEADER = 16;
+
+// The accounting stays out of line, inlined into a delete expression it looks like a mismatched free to the compiler.
+#if defined(__GNUC__)
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+static NOINLINE void *countedAllocate(size_t bytes)
+{
+    char *block = static_cast<char *>(std::malloc(bytes + HEADER));
+
+    if(block == NULL)
+    {
+        return NULL;
+    }
+
+    *reinterpret_cast<size_t *>(block) = bytes;
+
+    size_t used = heap_bytes.fetch_add(bytes) + bytes;
+    size_t peak = heap_peak.load();
+
+    while(used > peak && !heap_peak.compare_exchange_weak(peak, used))
+    {
+    }
+
+    return block + HEADER;
+}
+
+static NOINLINE void countedFree(void *p)
+{
+    if(p == NULL)
+    {
+        return;
+    }
+
+    char *block = static_cast<char *>(p) - HEADER;
+    heap_bytes.fetch_sub(*reinterpret_cast<size_t *>(block));
+    std::free(block);
+}
+
+void *operator new(size_t bytes)
+{
+    void *p = countedAllocate(bytes);
+
+    if(p == NULL)
+    {
+        throw std::bad_alloc();
+    }
+
+    return p;
+}
+
+void *operator new(size_t bytes, const std::nothrow_t &) noexcept { return countedAllocate(bytes); }
+void operator delete(void *p) noexcept { countedFree(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { countedFree(p); }
+void operator delete(void *p, size_t) noexcept { countedFree(p); }
+
+namespace
+{
+
+using gfx::Subdivider;
+
+// A triangle mesh in the plain arrays of the core.
+struct Mesh
+{
+    std::string name;
+    std::vector<float>    positions; // x, y, z per vertex.
+    std::vector<uint32_t> indices;   // 3 per triangle.
+
+    int NumVertices() const { return positions.size()/3; }
+    int NumTriangles() const { return indices.size()/3; }
+};
+
+struct Options
+{
+    std::string data;
+    std::string output;
+
+    int min_level;
+    int max_level;
+    int repeat;
+    int threads;
+
+    long long max_triangles;
+};
+
+struct Result
+{
+    std::string mesh;
+    std::string name;
+
+    int level;
+    int vertices;
+    int triangles;
+    int vertices_out;
+    int triangles_out;
+
+    double time_ms;
+    double cold_ms;
+    size_t peak_heap_bytes;
+};
+
+double seconds()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// -- Inputs.
+
+/* Reads an ascii PLY file. Missing z coordinates are 0, polygons are split into triangle fans.
+ * Returns false if the file can not be read.
+ */
+bool loadPly(const std::string &path, const std::string &name, Mesh &mesh)
+{
+    FILE *file = std::fopen(path.c_str(), "r");
+
+    if(file == NULL)
+    {
+        return false;
+    }
+
+    mesh.name = name;
+    mesh.positions.clear();
+    mesh.indices.clear();
+
+    // -- Header.
+    char line[256];
+    char word[64];
+    char kind[64];
+
+    int  num_vertices = 0;
+    int  num_faces    = 0;
+    int  num_properties = 0;
+    int  axis[3] = {-1, -1, -1};
+    bool in_vertex = false;
+    bool ascii     = false;
+
+    while(std::fgets(line, sizeof(line), file) != NULL)
+    {
+        if(std::strncmp(line, "end_header", 10) == 0)
+        {
+            break;
+        }
+
+        int count;
+
+        if(std::sscanf(line, "format %63s", word) == 1)
+        {
+            ascii = std::strcmp(word, "ascii") == 0;
+        }
+        else if(std::sscanf(line, "element %63s %d", word, &count) == 2)
+        {
+            in_vertex = std::strcmp(word, "vertex") == 0;
+            (in_vertex ? num_vertices : num_faces) = count;
+        }
+        else if(in_vertex && std::sscanf(line, "property %63s %63s", kind, word) == 2)
+        {
+            if(word[1] == '\0' && word[0] >= 'x' && word[0] <= 'z')
+            {
+                axis[word[0] - 'x'] = num_properties;
+            }
+
+            num_properties++;
+        }
+    }
+
+    if(!ascii || axis[0] == -1 || axis[1] == -1)
+    {
+        std::fclose(file);
+        return false;
+    }
+
+    // -- Vertices.
+    std::vector<float> values(num_properties);
+
+    for(int v = 0; v < num_vertices; v++)
+    {
+        for(int p = 0; p < num_properties; p++)
+        {
+            if(std::fscanf(file, "%f", &values[p]) != 1)
+            {
+                std::fclose(file);
+                return false;
+            }
+        }
+
+        for(int c = 0; c < 3; c++)
+        {
+            mesh.positions.push_back(axis[c] == -1 ? 0 : values[axis[c]]);
+        }
+    }
+
+    // -- Faces.
+    for(int f = 0; f < num_faces; f++)
+    {
+        int corners;
+
+        if(std::fscanf(file, "%d", &corners) != 1)
+        {
+            std::fclose(file);
+            return false;
+        }
+
+        std::vector<uint32_t> face(corners);
+
+        for(int k = 0; k < corners; k++)
+        {
+            if(std::fscanf(file, "%u", &face[k]) != 1)
+            {
+                std::fclose(file);
+                return false;
+            }
+        }
+
+        for(int k = 2; k < corners; k++)
+        {
+            mesh.indices.push_back(face[0]);
+            mesh.indices.push_back(face[k - 1]);
+            mesh.indices.push_back(face[k]);
+        }
+    }
+
+    std::fclose(file);
+    return true;
+}
+
+// A flat n x n grid of squares split into triangles, with a boundary.
+Mesh gridMesh(int n)
+{
+    Mesh mesh;
+    mesh.name = "grid" + std::to_string(n);
+
+    for(int y = 0; y <= n; y++)
+    {
+        for(int x = 0; x <= n; x++)
+        {
+            mesh.positions.push_back(10.0f*x);
+            mesh.positions.push_back(10.0f*y);
+            mesh.positions.push_back(0);
+        }
+    }
+
+    for(int y = 0; y < n; y++)
+    {
+        for(int x = 0; x < n; x++)
+        {
+            uint32_t a = y*(n + 1) + x;
+            uint32_t b = a + 1;
+            uint32_t c = a + n + 1;
+            uint32_t d = c + 1;
+
+            uint32_t triangles[6] = {a, b, d, a, d, c};
+            mesh.indices.insert(mesh.indices.end(), triangles, triangles + 6);
+        }
+    }
+
+    return mesh;
+}
+
+// A closed torus of 2 n x n squares split into triangles, every vertex has valence 6.
+Mesh torusMesh(int n)
+{
+    Mesh mesh;
+    mesh.name = "torus" + std::to_string(n);
+
+    const double pi = 3.14159265358979323846;
+    int around = 2*n;
+
+    for(int i = 0; i < around; i++)
+    {
+        for(int j = 0; j < n; j++)
+        {
+            double u = 2*pi*i/around;
+            double v = 2*pi*j/n;
+            double r = 100 + 40*std::cos(v);
+
+            mesh.positions.push_back(r*std::cos(u));
+            mesh.positions.push_back(r*std::sin(u));
+            mesh.positions.push_back(40*std::sin(v));
+        }
+    }
+
+    for(int i = 0; i < around; i++)
+    {
+        for(int j = 0; j < n; j++)
+        {
+            uint32_t a = i*n + j;
+            uint32_t b = ((i + 1)%around)*n + j;
+            uint32_t c = i*n + (j + 1)%n;
+            uint32_t d = ((i + 1)%around)*n + (j + 1)%n;
+
+            uint32_t triangles[6] = {a, b, d, a, d, c};
+            mesh.indices.insert(mesh.indices.end(), triangles, triangles + 6);
+        }
+    }
+
+    return mesh;
+}
+
+// -- Cases.
+
+const char *schemeName(Subdivider::Scheme scheme)
+{
+    switch(scheme)
+    {
+        case Subdivider::BUTTERFLY: return "butterfly";
+        case Subdivider::LINEAR:    return "linear";
+        case Subdivider::BOUNDARY:  return "boundary";
+        case Subdivider::PASCAL:    return "pascal";
+    }
+
+    return "unknown";
+}
+
+/* Calls run once to warm up and then options.repeat times, and fills in the times and the peak heap use.
+ * run returns nothing, the sizes of the result are filled in by the caller.
+ */
+template<class Run>
+void measure(const Options &options, Run run, Result &result)
+{
+    size_t base = heap_bytes.load();
+    heap_peak.store(base);
+
+    double start = seconds();
+    run();
+    result.cold_ms = 1000*(seconds() - start);
+
+    std::vector<double> times;
+
+    for(int r = 0; r < options.repeat; r++)
+    {
+        start = seconds();
+        run();
+        times.push_back(1000*(seconds() - start));
+    }
+
+    std::sort(times.begin(), times.end());
+    result.time_ms = times.empty() ? result.cold_ms : times[times.size()/2];
+    result.peak_heap_bytes = heap_peak.load() - base;
+}
+
+Result newResult(const Mesh &mesh, const std::string &name, int level)
+{
+    Result result;
+    result.mesh      = mesh.name;
+    result.name      = name;
+    result.level     = level;
+    result.vertices  = mesh.NumVertices();
+    result.triangles = mesh.NumTriangles();
+    result.vertices_out  = 0;
+    result.triangles_out = 0;
+    result.time_ms = result.cold_ms = 0;
+    result.peak_heap_bytes = 0;
+    return result;
+}
+
+// SubdivideStart(), Subdivide() and GetMesh(), as subdivideButterfly(mesh, level) and the others do.
+Result benchmarkSubdivide(const Options &options, const Mesh &mesh, Subdivider::Scheme scheme, int level)
+{
+    Result result = newResult(mesh, std::string("subdivide_") + schemeName(scheme), level);
+
+    Subdivider core;
+    core.SetThreadCount(options.threads);
+
+    std::vector<float>    positions;
+    std::vector<uint32_t> indices;
+
+    measure(options, [&]()
+    {
+        core.SubdivideStart(&mesh.positions[0], mesh.NumVertices(), 3, &mesh.indices[0], mesh.indices.size());
+        core.Subdivide(scheme, level, -1);
+
+        int num_vertices, num_indices;
+        core.GetMeshSize(num_vertices, num_indices);
+
+        positions.resize(3*num_vertices);
+        indices.resize(num_indices);
+        core.GetMesh(positions.empty() ? NULL : &positions[0], 3, indices.empty() ? NULL : &indices[0]);
+
+        result.vertices_out  = num_vertices;
+        result.triangles_out = num_indices/3;
+    }, result);
+
+    return result;
+}
+
+// TopologyStart(), TopologySubdivide() and TopologyEnd(), as topology_start, topology_subdivide_* and topology_end do.
+// Leaves the compiled topology in core for benchmarkFixMesh().
+Result benchmarkTopology(const Options &options, const Mesh &mesh, Subdivider::Scheme scheme, int level, Subdivider &core)
+{
+    Result result = newResult(mesh, std::string("topology_") + schemeName(scheme), level);
+
+    measure(options, [&]()
+    {
+        core.TopologyStart(&mesh.positions[0], mesh.NumVertices(), 3, &mesh.indices[0], mesh.indices.size());
+        core.TopologySubdivide(scheme, level);
+        core.TopologyEnd();
+    }, result);
+
+    int num_vertices, num_indices;
+    core.GetMeshSize(num_vertices, num_indices);
+    result.vertices_out  = num_vertices;
+    result.triangles_out = num_indices/3;
+
+    return result;
+}
+
+// FixMesh() on the topology compiled by benchmarkTopology(), with the control vertices moved before every call.
+Result benchmarkFixMesh(const Options &options, const Mesh &mesh, int level, Subdivider &core)
+{
+    Result result = newResult(mesh, "fix_mesh", level);
+
+    int num_vertices, num_indices;
+    core.GetMeshSize(num_vertices, num_indices);
+
+    std::vector<float> positions(mesh.positions);
+    std::vector<float> subdivided(3*num_vertices);
+    int frame = 0;
+
+    measure(options, [&]()
+    {
+        float offset = 0.01f*(++frame);
+
+        for(size_t i = 0; i < positions.size(); i++)
+        {
+            positions[i] = mesh.positions[i] + offset;
+        }
+
+        core.FixMesh(&positions[0], mesh.NumVertices(), 3, &subdivided[0], num_vertices, 3);
+    }, result);
+
+    result.vertices_out  = num_vertices;
+    result.triangles_out = num_indices/3;
+
+    return result;
+}
+
+// -- Output.
+
+void writeResult(FILE *out, const Result &result, bool last)
+{
+    double per_second = result.time_ms > 0 ? result.triangles_out/(result.time_ms/1000) : 0;
+
+    std::fprintf(out, "    {\"mesh\": \"%s\", \"case\": \"%s\", \"level\": %d, "
+                      "\"vertices\": %d, \"triangles\": %d, \"vertices_out\": %d, \"triangles_out\": %d, "
+                      "\"time_ms\": %.4f, \"cold_ms\": %.4f, \"triangles_per_second\": %.1f, \"peak_heap_bytes\": %zu}%s\n",
+                 result.mesh.c_str(), result.name.c_str(), result.level,
+                 result.vertices, result.triangles, result.vertices_out, result.triangles_out,
+                 result.time_ms, result.cold_ms, per_second, result.peak_heap_bytes, last ? "" : ",");
+}
+
+// The peak resident set size of the process in bytes, 0 where it is not known.
+size_t maxResidentBytes()
+{
+#ifndef _WIN32
+    struct rusage usage;
+
+    if(getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+#ifdef __APPLE__
+        return usage.ru_maxrss;
+#else
+        return (size_t)usage.ru_maxrss*1024;
+#endif
+    }
+#endif
+
+    return 0;
+}
+
+void usage()
+{
+    std::fprintf(stderr, "usage : butterfly_benchmark [--data DIR] [--levels MIN-MAX] [--repeat N] [--threads N]\n"
+                         "                            [--max-triangles N] [--output FILE]\n");
+}
+
+bool parseOptions(int argc, char **argv, Options &options)
+{
+    options.data      = BUTTERFLY_DATA_DIR;
+    options.min_level = 1;
+    options.max_level = 6;
+    options.repeat    = 3;
+    options.threads   = 0;
+    options.max_triangles = 8000000;
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+
+        if(i + 1 >= argc)
+        {
+            return false;
+        }
+
+        const char *value = argv[++i];
+
+        if(option == "--data")
+        {
+            options.data = value;
+        }
+        else if(option == "--output")
+        {
+            options.output = value;
+        }
+        else if(option == "--levels")
+        {
+            if(std::sscanf(value, "%d-%d", &options.min_level, &options.max_level) != 2)
+            {
+                options.max_level = options.min_level;
+            }
+        }
+        else if(option == "--repeat")
+        {
+            options.repeat = std::atoi(value);
+        }
+        else if(option == "--threads")
+        {
+            options.threads = std::atoi(value);
+        }
+        else if(option == "--max-triangles")
+        {
+            options.max_triangles = std::atoll(value);
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return options.min_level >= 1 && options.min_level <= options.max_level && options.repeat >= 0 && options.threads >= 0;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+
+    if(!parseOptions(argc, argv, options))
+    {
+        usage();
+        return 1;
+    }
+
+    // -- The bundled meshes, then synthetic meshes with 4 times as many triangles each.
+    std::vector<Mesh> meshes;
+    const char *files[] = {"triangle", "hand151", "handmarksNew"};
+
+    for(int i = 0; i < 3; i++)
+    {
+        Mesh mesh;
+
+        if(loadPly(options.data + "/" + files[i] + ".ply", files[i], mesh))
+        {
+            meshes.push_back(mesh);
+        }
+        else
+        {
+            std::fprintf(stderr, "butterfly_benchmark : skipping %s/%s.ply, it could not be read.\n",
+                         options.data.c_str(), files[i]);
+        }
+    }
+
+    for(int n = 16; n <= 64; n *= 2)
+    {
+        meshes.push_back(gridMesh(n));
+    }
+
+    for(int n = 8; n <= 32; n *= 2)
+    {
+        meshes.push_back(torusMesh(n));
+    }
+
+    // -- Run every case from the lowest level up, until its next level would pass max_triangles.
+    const Subdivider::Scheme schemes[] = {Subdivider::BUTTERFLY, Subdivider::LINEAR, Subdivider::PASCAL, Subdivider::BOUNDARY};
+    std::vector<Result> results;
+
+    try
+    {
+        for(size_t m = 0; m < meshes.size(); m++)
+        {
+            const Mesh &mesh = meshes[m];
+
+            for(int s = 0; s < 4; s++)
+            {
+                long long triangles = mesh.NumTriangles();
+
+                for(int level = options.min_level; level <= options.max_level && triangles*4 <= options.max_triangles; level++)
+                {
+                    results.push_back(benchmarkSubdivide(options, mesh, schemes[s], level));
+                    triangles = results.back().triangles_out;
+
+                    Subdivider core;
+                    core.SetThreadCount(options.threads);
+                    results.push_back(benchmarkTopology(options, mesh, schemes[s], level, core));
+
+                    if(schemes[s] == Subdivider::BUTTERFLY)
+                    {
+                        results.push_back(benchmarkFixMesh(options, mesh, level, core));
+                    }
+
+                    std::fprintf(stderr, "%s %s level %d : %d triangles\n", mesh.name.c_str(), schemeName(schemes[s]),
+                                 level, (int)triangles);
+                }
+            }
+        }
+    }
+    catch(const RuntimeError &error)
+    {
+        std::fprintf(stderr, "butterfly_benchmark : %s\n", error.Message().c_str());
+        return 1;
+    }
+
+    FILE *out = options.output.empty() ? stdout : std::fopen(options.output.c_str(), "w");
+
+    if(out == NULL)
+    {
+        std::fprintf(stderr, "butterfly_benchmark : %s could not be written.\n", options.output.c_str());
+        return 1;
+    }
+
+    std::fprintf(out, "{\n  \"threads\": %d,\n  \"repeat\": %d,\n  \"max_triangles\": %lld,\n",
+                 options.threads, options.repeat, options.max_triangles);
+    std::fprintf(out, "  \"results\": [\n");
+
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        writeResult(out, results[i], i + 1 == results.size());
+    }
+
+    std::fprintf(out, "  ],\n  \"max_resident_bytes\": %zu\n}\n", maxResidentBytes());
+
+    if(out != stdout)
+    {
+        std::fclose(out);
+    }
+
+    return 0;
+}
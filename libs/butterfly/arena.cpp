@@ -0,0 +1,84 @@
+#include <algorithm>
+#include "arena.hpp"
+
+namespace gfx
+{
+
+    Arena::Arena(size_t block_size) :
+        first_block_size(std::max(block_size, (size_t)64)), block_size(first_block_size), current(0), offset(0), used(0)
+    {
+    }
+
+    Arena::Arena(const Arena &arena) :
+        first_block_size(arena.first_block_size), block_size(first_block_size), current(0), offset(0), used(0)
+    {
+    }
+
+    Arena &Arena::operator=(const Arena &)
+    {
+        // The blocks are kept, only what was allocated from them is given up.
+        Reset();
+        return *this;
+    }
+
+    Arena::~Arena()
+    {
+        for(size_t i = 0; i < blocks.size(); i++)
+        {
+            ::operator delete(blocks[i].data);
+        }
+    }
+
+    void *Arena::Allocate(size_t bytes, size_t alignment)
+    {
+        // Carve the current block, or move on to the first later block with enough room.
+        while(current < blocks.size())
+        {
+            size_t start = (offset + alignment - 1) & ~(alignment - 1);
+
+            if(start + bytes <= blocks[current].size)
+            {
+                offset = start + bytes;
+                used  += bytes;
+                return blocks[current].data + start;
+            }
+
+            current++;
+            offset = 0;
+        }
+
+        // Every block is full. ::operator new aligns for any fundamental type.
+        Block block;
+        block.size = std::max(block_size, bytes + alignment);
+        block.data = static_cast<char *>(::operator new(block.size));
+        blocks.push_back(block);
+
+        block_size *= 2;
+
+        size_t start = (alignment - (size_t)block.data % alignment) % alignment;
+        offset = start + bytes;
+        used  += bytes;
+        return block.data + start;
+    }
+
+    void Arena::Reset()
+    {
+        current = 0;
+        offset  = 0;
+        used    = 0;
+    }
+
+    size_t Arena::Capacity() const
+    {
+        size_t capacity = 0;
+
+        for(size_t i = 0; i < blocks.size(); i++)
+        {
+            capacity += blocks[i].size;
+        }
+
+        return capacity;
+    }
+
+    /* end */
+}
@@ -0,0 +1,110 @@
+#ifndef __GFX_ARENA_HPP
+#define __GFX_ARENA_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace gfx
+{
+
+/* A monotonic allocator for data that lives for one subdivision level.
+ *
+ * Allocations are carved out of large blocks and are never freed one by one. Reset() releases everything at once
+ * but keeps the blocks, so once an arena has grown to the size of a level, the following levels and frames
+ * do not allocate at all.
+ *
+ * An arena may only be used by one thread at a time.
+ */
+class Arena
+{
+public:
+    explicit Arena(size_t block_size = 1 << 16);
+
+    // The memory of an arena is never shared. Copies start without blocks, assignments keep their own.
+    Arena(const Arena &arena);
+    Arena &operator=(const Arena &arena);
+
+    ~Arena();
+
+    // Returns bytes of memory aligned to alignment, a power of two.
+    void *Allocate(size_t bytes, size_t alignment);
+
+    // Makes all of the blocks available again. Everything allocated before is invalid afterwards.
+    void Reset();
+
+    // The bytes handed out since the last Reset(), and the bytes of all of the blocks.
+    size_t Used() const { return used; }
+    size_t Capacity() const;
+
+private:
+    struct Block
+    {
+        char  *data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+
+    size_t first_block_size;
+    size_t block_size; // The size of the next new block, doubles with every block.
+    size_t current;    // The block that is being carved, blocks.size() if there is none.
+    size_t offset;     // The first free byte of the current block.
+    size_t used;
+};
+
+/* A standard allocator that takes its memory from an arena, or from the heap if it has none.
+ *
+ * deallocate() does nothing for arena memory, the memory comes back with Arena::Reset(),
+ * so a container that uses an arena must be destroyed before the arena is reset.
+ * Copies of such containers are made on the heap, they may outlive the arena.
+ */
+template<class T>
+struct ArenaAllocator
+{
+    typedef T value_type;
+
+    // Swapped and moved containers take their memory along with its arena.
+    typedef std::true_type  propagate_on_container_swap;
+    typedef std::true_type  propagate_on_container_move_assignment;
+    typedef std::false_type propagate_on_container_copy_assignment;
+
+    Arena *arena;
+
+    ArenaAllocator() : arena(NULL) {}
+    explicit ArenaAllocator(Arena *arena) : arena(arena) {}
+
+    template<class U>
+    ArenaAllocator(const ArenaAllocator<U> &allocator) : arena(allocator.arena) {}
+
+    T *allocate(size_t n)
+    {
+        if(arena == NULL)
+        {
+            return static_cast<T *>(::operator new(n*sizeof(T)));
+        }
+
+        return static_cast<T *>(arena -> Allocate(n*sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, size_t)
+    {
+        if(arena == NULL)
+        {
+            ::operator delete(p);
+        }
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const { return ArenaAllocator(); }
+};
+
+template<class T, class U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena == b.arena; }
+
+template<class T, class U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena != b.arena; }
+
+/* end */
+}
+#endif
@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "cache.hpp"
+#include "error.hpp"
+
+#ifdef _WIN32
+#define GFX_NO_MMAP
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace gfx
+{
+
+    static const char MAGIC[8] = {'B', 'F', 'L', 'Y', 'T', 'O', 'P', 'O'};
+
+    struct CacheHeader
+    {
+        char     magic[8];
+        uint32_t version;
+        uint32_t num_control;
+        uint64_t key;
+
+        uint32_t num_levels;
+        uint32_t num_rows;
+        uint32_t num_taps;
+        uint32_t num_indices;
+    };
+
+    // The size of the file that the header describes.
+    static size_t cacheSize(const CacheHeader &header)
+    {
+        return sizeof(CacheHeader)
+             + sizeof(int)*(size_t)header.num_levels
+             + sizeof(int)*((size_t)header.num_rows + 1)
+             + (sizeof(int) + sizeof(float))*(size_t)header.num_taps
+             + sizeof(uint32_t)*(size_t)header.num_indices;
+    }
+
+    uint64_t HashBytes(const void *data, size_t size, uint64_t hash)
+    {
+        const unsigned char *bytes = (const unsigned char *)data;
+
+        for(size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+
+        return hash;
+    }
+
+    template <class T>
+    static void writeArray(FILE *file, const T *data, size_t count)
+    {
+        if(count > 0)
+        {
+            fwrite(data, sizeof(T), count, file);
+        }
+    }
+
+    void SaveTopologyCache(const char *path, uint64_t key, const StencilTable &table, const std::vector<uint32_t> &indices)
+    {
+        CacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+
+        header.version     = TOPOLOGY_CACHE_VERSION;
+        header.num_control = table.NumControlVertices();
+        header.key         = key;
+        header.num_levels  = table.levels.size();
+        header.num_rows    = table.offsets.size() - 1;
+        header.num_taps    = table.sources.size();
+        header.num_indices = indices.size();
+
+        // The file is written next to the path and renamed over it, so processes that have the old file mapped
+        // keep reading the old file rather than a truncated one.
+        std::string temporary = std::string(path) + ".tmp";
+        FILE *file = fopen(temporary.c_str(), "wb");
+
+        if(file == NULL)
+        {
+            throw RuntimeError("Topology Cache Error: The cache file could not be written.");
+        }
+
+        fwrite(&header, sizeof(header), 1, file);
+        writeArray(file, table.levels.data(), table.levels.size());
+        writeArray(file, table.offsets.data(), table.offsets.size());
+        writeArray(file, table.sources.data(), table.sources.size());
+        writeArray(file, table.weights.data(), table.weights.size());
+        writeArray(file, indices.empty() ? NULL : &indices[0], indices.size());
+
+        bool failed = ferror(file) != 0;
+
+        if(fclose(file) != 0 || failed)
+        {
+            remove(temporary.c_str());
+            throw RuntimeError("Topology Cache Error: The cache file could not be written.");
+        }
+
+#ifdef _WIN32
+        // rename() does not replace files on Windows.
+        remove(path);
+#endif
+
+        if(rename(temporary.c_str(), path) != 0)
+        {
+            remove(temporary.c_str());
+            throw RuntimeError("Topology Cache Error: The cache file could not be written.");
+        }
+    }
+
+    // Makes array read count values of the file contents in place, advancing data.
+    template <class T>
+    static void shareArray(const std::shared_ptr<const void> &contents, const char *&data, size_t count,
+                           SharedArray<T> &array)
+    {
+        array.Share(contents, (const T *)data, count);
+        data += sizeof(T)*count;
+    }
+
+    // Points the table and indices into the contents of a cache file, which contents keeps alive.
+    static bool parseCache(const std::shared_ptr<const void> &contents, const char *data, size_t size, uint64_t key,
+                           StencilTable &table, SharedArray<uint32_t> &indices)
+    {
+        CacheHeader header;
+
+        if(size < sizeof(header))
+        {
+            return false;
+        }
+
+        memcpy(&header, data, sizeof(header));
+
+        if(memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != TOPOLOGY_CACHE_VERSION ||
+           header.key != key || cacheSize(header) != size)
+        {
+            return false;
+        }
+
+        // Every row belongs to a level, and the indices form whole triangles.
+        if((header.num_levels == 0 && header.num_rows > 0) || header.num_indices % 3 != 0)
+        {
+            return false;
+        }
+
+        data += sizeof(header);
+
+        StencilTable loaded;
+        loaded.Clear(header.num_control);
+
+        shareArray(contents, data, header.num_levels, loaded.levels);
+        shareArray(contents, data, header.num_rows + 1, loaded.offsets);
+        shareArray(contents, data, header.num_taps, loaded.sources);
+        shareArray(contents, data, header.num_taps, loaded.weights);
+
+        SharedArray<uint32_t> triangles;
+        shareArray(contents, data, header.num_indices, triangles);
+
+        // The offsets and levels must stay inside the table, and every row may only read earlier vertices.
+        if(loaded.offsets[0] != 0 || loaded.offsets.back() != (int)header.num_taps ||
+           (header.num_levels > 0 && loaded.levels.back() != (int)header.num_rows))
+        {
+            return false;
+        }
+
+        for(uint32_t r = 0; r < header.num_rows; r++)
+        {
+            if(loaded.offsets[r] > loaded.offsets[r + 1])
+            {
+                return false;
+            }
+
+            for(int k = loaded.offsets[r]; k < loaded.offsets[r + 1]; k++)
+            {
+                if(loaded.sources[k] < 0 || loaded.sources[k] >= (int)(header.num_control + r))
+                {
+                    return false;
+                }
+            }
+        }
+
+        for(uint32_t l = 0; l < header.num_levels; l++)
+        {
+            if(loaded.levels[l] < (l > 0 ? loaded.levels[l - 1] : 0))
+            {
+                return false;
+            }
+        }
+
+        for(uint32_t i = 0; i < header.num_indices; i++)
+        {
+            if(triangles[i] >= header.num_control + header.num_rows)
+            {
+                return false;
+            }
+        }
+
+        std::swap(table, loaded);
+        indices.swap(triangles);
+        return true;
+    }
+
+#ifndef GFX_NO_MMAP
+    // A read only mapping of a whole file, unmapped with the last array that reads it.
+    struct MappedFile
+    {
+        void  *data;
+        size_t size;
+
+        MappedFile(void *data, size_t size) : data(data), size(size) {}
+        ~MappedFile() { munmap(data, size); }
+    };
+#endif
+
+    bool LoadTopologyCache(const char *path, uint64_t key, StencilTable &table, SharedArray<uint32_t> &indices)
+    {
+#ifdef GFX_NO_MMAP
+        FILE *file = fopen(path, "rb");
+
+        if(file == NULL)
+        {
+            return false;
+        }
+
+        // The arrays read the file contents in place, as they would read a mapping.
+        std::shared_ptr<std::vector<char> > contents = std::make_shared<std::vector<char> >();
+        char buffer[1 << 16];
+
+        for(size_t count; (count = fread(buffer, 1, sizeof(buffer), file)) > 0; )
+        {
+            contents -> insert(contents -> end(), buffer, buffer + count);
+        }
+
+        fclose(file);
+
+        return !contents -> empty() && parseCache(contents, &(*contents)[0], contents -> size(), key, table, indices);
+#else
+        int file = open(path, O_RDONLY);
+
+        if(file == -1)
+        {
+            return false;
+        }
+
+        struct stat info;
+
+        if(fstat(file, &info) != 0 || info.st_size == 0)
+        {
+            close(file);
+            return false;
+        }
+
+        size_t size = info.st_size;
+        void *data  = mmap(NULL, size, PROT_READ, MAP_SHARED, file, 0);
+        close(file);
+
+        if(data == MAP_FAILED)
+        {
+            return false;
+        }
+
+        // The table and indices read the mapping in place, so its pages are shared with every other process
+        // that maps the same file. It is unmapped once the last of them is cleared, or at once if the file is rejected.
+        std::shared_ptr<const void> mapping = std::make_shared<MappedFile>(data, size);
+
+        return parseCache(mapping, (const char *)data, size, key, table, indices);
+#endif
+    }
+
+    /* end */
+}
@@ -0,0 +1,34 @@
+#ifndef __GFX_CACHE_HPP
+#define __GFX_CACHE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "stencil.hpp"
+
+namespace gfx
+{
+
+// The layout version of topology cache files, files of any other version are not loaded.
+static const uint32_t TOPOLOGY_CACHE_VERSION = 1;
+
+// 64 bit FNV-1a, continued from hash.
+uint64_t HashBytes(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL);
+
+/* Writes the stencil table and the output triangles of a compiled topology to a binary file, under the given key.
+ * The file is written in the byte order of the machine, with a header that records the version and the key.
+ * An existing file is replaced at once, processes that have it mapped keep reading its old contents.
+ */
+void SaveTopologyCache(const char *path, uint64_t key, const StencilTable &table, const std::vector<uint32_t> &indices);
+
+/* Reads a file written by SaveTopologyCache() through a memory map.
+ * The table and indices read the mapped file in place rather than copies of it, and keep it mapped until they are
+ * cleared or changed, so processes that load the same file share its pages.
+ * Returns false, leaving table and indices alone, if the file can not be read, is truncated, is inconsistent,
+ * or was written for another version or key.
+ */
+bool LoadTopologyCache(const char *path, uint64_t key, StencilTable &table, SharedArray<uint32_t> &indices);
+
+/* end */
+}
+#endif
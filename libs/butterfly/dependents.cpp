@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <string.h>
+#include "dependents.hpp"
+#include "error.hpp"
+#include "simd.hpp"
+
+namespace gfx
+{
+
+    void StencilDependents::Build(const StencilTable &table)
+    {
+        num_control = table.NumControlVertices();
+
+        int num_vertices = table.NumVertices();
+        int num_rows     = table.offsets.size() - 1;
+
+        // -- Count the readers of every vertex, then place the rows in ascending order.
+        offsets.assign(num_vertices + 1, 0);
+
+        for(size_t k = 0; k < table.sources.size(); k++)
+        {
+            offsets[table.sources[k] + 1]++;
+        }
+
+        for(int v = 0; v < num_vertices; v++)
+        {
+            offsets[v + 1] += offsets[v];
+        }
+
+        dependents.resize(table.sources.size());
+        std::vector<int> next(offsets.begin(), offsets.end() - 1);
+
+        for(int r = 0; r < num_rows; r++)
+        {
+            for(int k = table.offsets[r]; k < table.offsets[r + 1]; k++)
+            {
+                dependents[next[table.sources[k]]++] = r;
+            }
+        }
+
+        marked.assign(num_rows, false);
+    }
+
+    void StencilDependents::AffectedRows(const int *vertices, int count, std::vector<int> &rows)
+    {
+        rows.clear();
+
+        for(int i = 0; i < count; i++)
+        {
+            if(vertices[i] < 0 || vertices[i] >= NumVertices())
+            {
+                throw RuntimeError("StencilDependents Error: A changed vertex is out of range.");
+            }
+        }
+
+        // Every collected row is a changed vertex itself, so the list is walked while it grows.
+        for(int i = -count; i < (int)rows.size(); i++)
+        {
+            int v = i < 0 ? vertices[count + i] : num_control + rows[i];
+
+            for(int k = offsets[v]; k < offsets[v + 1]; k++)
+            {
+                int r = dependents[k];
+
+                if(!marked[r])
+                {
+                    marked[r] = true;
+                    rows.push_back(r);
+                }
+            }
+        }
+
+        for(size_t i = 0; i < rows.size(); i++)
+        {
+            marked[rows[i]] = false;
+        }
+
+        std::sort(rows.begin(), rows.end());
+    }
+
+    // Compares the packed triples of vertices [begin, end) bit for bit.
+    static void diffScalar(const float *positions, int begin, int end, int stride, float *snapshot, std::vector<int> &changed)
+    {
+        for(int i = begin; i < end; i++)
+        {
+            const float *p = positions + i*stride;
+            float *q = snapshot + 3*i;
+
+            if(memcmp(p, q, 3*sizeof(float)) != 0)
+            {
+                q[0] = p[0];
+                q[1] = p[1];
+                q[2] = p[2];
+                changed.push_back(i);
+            }
+        }
+    }
+
+#ifdef GFX_SIMD_X86
+
+    // Compares 4 packed vertices, 12 floats, per step. Returns the number of vertices it has compared.
+    GFX_TARGET("sse2")
+    static int diffSSE(const float *positions, int num_vertices, float *snapshot, std::vector<int> &changed)
+    {
+        int i = 0;
+        for(; i + 4 <= num_vertices; i += 4)
+        {
+            const __m128i *p = (const __m128i *)(positions + 3*i);
+            const __m128i *q = (const __m128i *)(snapshot + 3*i);
+
+            // One bit per float that is equal.
+            int equal = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128(p + 0), _mm_loadu_si128(q + 0))))
+                     | _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128(p + 1), _mm_loadu_si128(q + 1)))) << 4
+                     | _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128(p + 2), _mm_loadu_si128(q + 2)))) << 8;
+
+            if(equal == 0xfff)
+            {
+                continue;
+            }
+
+            for(int j = 0; j < 4; j++)
+            {
+                if(((equal >> 3*j) & 7) != 7)
+                {
+                    float *s = snapshot + 3*(i + j);
+                    const float *v = positions + 3*(i + j);
+                    s[0] = v[0];
+                    s[1] = v[1];
+                    s[2] = v[2];
+                    changed.push_back(i + j);
+                }
+            }
+        }
+
+        return i;
+    }
+
+#endif
+
+    void DiffPositions(const float *positions, int num_vertices, int stride, float *snapshot, std::vector<int> &changed)
+    {
+        int begin = 0;
+
+#ifdef GFX_SIMD_X86
+        static const bool sse2 = (__builtin_cpu_init(), __builtin_cpu_supports("sse2"));
+
+        if(stride == 3 && sse2)
+        {
+            begin = diffSSE(positions, num_vertices, snapshot, changed);
+        }
+#endif
+
+        diffScalar(positions, begin, num_vertices, stride, snapshot, changed);
+    }
+
+    /* end */
+}
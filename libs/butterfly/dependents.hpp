@@ -0,0 +1,47 @@
+#ifndef __GFX_DEPENDENTS_HPP
+#define __GFX_DEPENDENTS_HPP
+
+#include <vector>
+#include "stencil.hpp"
+
+namespace gfx
+{
+
+/* The reverse of a stencil table : the rows that read every vertex, in compressed sparse row form.
+ *
+ * When only a few control vertices move, AffectedRows() follows the index through every level
+ * to the rows that have to be evaluated again, and StencilTable::ApplyRows() evaluates just those.
+ */
+class StencilDependents
+{
+public:
+    StencilDependents() : num_control(0) { offsets.push_back(0); }
+
+    void Build(const StencilTable &table);
+
+    int NumVertices() const { return offsets.size() - 1; }
+
+    /* Collects the rows that read any of the given vertices, directly or through other rows, in ascending order.
+     * Ascending rows are in level order, so they can be passed to StencilTable::ApplyRows().
+     */
+    void AffectedRows(const int *vertices, int count, std::vector<int> &rows);
+
+private:
+    int num_control;
+
+    std::vector<int> offsets;
+    std::vector<int> dependents;
+
+    // Rows already collected by the running AffectedRows() call.
+    std::vector<bool> marked;
+};
+
+/* Compares the num_vertices x, y, z triples of positions, stride floats apart, with the packed triples of snapshot,
+ * appends the indices of the vertices whose bits differ to changed and copies their new positions into snapshot.
+ * Packed positions are compared 4 vertices at a time with SSE2 when the processor supports it.
+ */
+void DiffPositions(const float *positions, int num_vertices, int stride, float *snapshot, std::vector<int> &changed);
+
+/* end */
+}
+#endif
@@ -0,0 +1,357 @@
+#include <algorithm>
+#include "evaluator.hpp"
+#include "error.hpp"
+#include "profile.hpp"
+#include "simd.hpp"
+
+namespace gfx
+{
+
+    static const int BLOCK = StencilEvaluator::BLOCK;
+
+    // Blocks and vertices per chunk of a parallel loop.
+    static const int BLOCK_GRAIN  = 64;
+    static const int VERTEX_GRAIN = 4096;
+
+    // Evaluates blocks of stencils that all have size taps, writing BLOCK consecutive slots per block.
+    typedef void (*Kernel)(const int *indices, const float *weights, int size, int blocks,
+                           float *const *channels, int width, int slot);
+
+    static void scalarKernel(const int *indices, const float *weights, int size, int blocks,
+                             float *const *channels, int width, int slot)
+    {
+        for(int b = 0; b < blocks; b++)
+        {
+            const int   *index  = indices + b*size*BLOCK;
+            const float *weight = weights + b*size*BLOCK;
+
+            for(int c = 0; c < width; c++)
+            {
+                const float *channel = channels[c];
+
+                for(int lane = 0; lane < BLOCK; lane++)
+                {
+                    float sum = 0;
+                    for(int k = 0; k < size; k++)
+                    {
+                        sum += channel[index[k*BLOCK + lane]]*weight[k*BLOCK + lane];
+                    }
+
+                    channels[c][slot + b*BLOCK + lane] = sum;
+                }
+            }
+        }
+    }
+
+#ifdef GFX_SIMD_X86
+
+    GFX_TARGET("sse2")
+    static void sseKernel(const int *indices, const float *weights, int size, int blocks,
+                          float *const *channels, int width, int slot)
+    {
+        for(int b = 0; b < blocks; b++)
+        {
+            for(int half = 0; half < BLOCK; half += 4)
+            {
+                const int   *index  = indices + b*size*BLOCK + half;
+                const float *weight = weights + b*size*BLOCK + half;
+
+                __m128 sum[4];
+                for(int c = 0; c < width; c++)
+                {
+                    sum[c] = _mm_setzero_ps();
+                }
+
+                for(int k = 0; k < size; k++)
+                {
+                    const int *i = index + k*BLOCK;
+                    __m128 w = _mm_loadu_ps(weight + k*BLOCK);
+
+                    for(int c = 0; c < width; c++)
+                    {
+                        const float *channel = channels[c];
+                        __m128 source = _mm_set_ps(channel[i[3]], channel[i[2]], channel[i[1]], channel[i[0]]);
+                        sum[c] = _mm_add_ps(sum[c], _mm_mul_ps(source, w));
+                    }
+                }
+
+                for(int c = 0; c < width; c++)
+                {
+                    _mm_storeu_ps(channels[c] + slot + b*BLOCK + half, sum[c]);
+                }
+            }
+        }
+    }
+
+    GFX_TARGET("avx2")
+    static void avx2Kernel(const int *indices, const float *weights, int size, int blocks,
+                           float *const *channels, int width, int slot)
+    {
+        for(int b = 0; b < blocks; b++)
+        {
+            const int   *index  = indices + b*size*BLOCK;
+            const float *weight = weights + b*size*BLOCK;
+
+            __m256 sum[4];
+            for(int c = 0; c < width; c++)
+            {
+                sum[c] = _mm256_setzero_ps();
+            }
+
+            for(int k = 0; k < size; k++)
+            {
+                __m256i i = _mm256_loadu_si256((const __m256i *)(index + k*BLOCK));
+                __m256  w = _mm256_loadu_ps(weight + k*BLOCK);
+
+                for(int c = 0; c < width; c++)
+                {
+                    __m256 source = _mm256_i32gather_ps(channels[c], i, 4);
+                    sum[c] = _mm256_add_ps(sum[c], _mm256_mul_ps(source, w));
+                }
+            }
+
+            for(int c = 0; c < width; c++)
+            {
+                _mm256_storeu_ps(channels[c] + slot + b*BLOCK, sum[c]);
+            }
+        }
+    }
+
+#endif
+
+    StencilEvaluator::StencilEvaluator() :
+        mode(BestMode()), num_control(0), num_vertices(0), num_slots(0)
+    {
+    }
+
+    StencilEvaluator::Mode StencilEvaluator::BestMode()
+    {
+#ifdef GFX_SIMD_X86
+        __builtin_cpu_init();
+
+        if(__builtin_cpu_supports("avx2"))
+        {
+            return AVX2;
+        }
+
+        if(__builtin_cpu_supports("sse2"))
+        {
+            return SSE;
+        }
+#endif
+        return SCALAR;
+    }
+
+    void StencilEvaluator::SetMode(Mode requested)
+    {
+        mode = std::min(requested, BestMode());
+    }
+
+    void StencilEvaluator::Compile(const StencilTable &table)
+    {
+        GFX_PROFILE_SCOPE("compile_evaluator");
+
+        num_control  = table.NumControlVertices();
+        num_vertices = table.NumVertices();
+
+        int rows = num_vertices - num_control;
+
+        groups.clear();
+        wavefronts.clear();
+        indices.clear();
+        weights.clear();
+        slot_vertex.clear();
+
+        // -- Every row goes one wavefront after the latest of its sources.
+        std::vector<int> wavefront(num_vertices, 0);
+        for(int r = 0; r < rows; r++)
+        {
+            int w = 0;
+            for(int k = table.offsets[r]; k < table.offsets[r + 1]; k++)
+            {
+                w = std::max(w, wavefront[table.sources[k]]);
+            }
+
+            wavefront[num_control + r] = w + 1;
+        }
+
+        // -- Sort the rows by wavefront, then by size.
+        std::vector<long long> keys(rows);
+        for(int r = 0; r < rows; r++)
+        {
+            long long size = table.offsets[r + 1] - table.offsets[r];
+            keys[r] = ((long long)wavefront[num_control + r] << 48) | (size << 32) | r;
+        }
+
+        std::sort(keys.begin(), keys.end());
+
+        // -- Assign slots and lay out the taps of every group.
+        std::vector<int> vertex_slot(num_vertices);
+        for(int v = 0; v < num_control; v++)
+        {
+            vertex_slot[v] = v;
+        }
+
+        num_slots = num_control;
+
+        for(int first = 0; first < rows; )
+        {
+            int row = keys[first] & 0xffffffff;
+
+            Group group;
+            group.wavefront = keys[first] >> 48;
+            group.size      = table.offsets[row + 1] - table.offsets[row];
+            group.slot      = num_slots;
+            group.taps      = indices.size();
+            group.block     = 0;
+
+            if(groups.empty() || groups.back().wavefront != group.wavefront)
+            {
+                wavefronts.push_back(groups.size());
+            }
+            else
+            {
+                group.block = groups.back().block + groups.back().blocks;
+            }
+
+            int last = first;
+            while(last < rows && (keys[last] >> 32) == (keys[first] >> 32))
+            {
+                last++;
+            }
+
+            int count = last - first;
+            group.blocks = (count + BLOCK - 1)/BLOCK;
+
+            for(int i = 0; i < group.blocks*BLOCK; i++)
+            {
+                int vertex = i < count ? num_control + (int)(keys[first + i] & 0xffffffff) : -1;
+
+                slot_vertex.push_back(vertex);
+                if(vertex != -1)
+                {
+                    vertex_slot[vertex] = num_slots + i;
+                }
+            }
+
+            // Padding lanes read slot 0 with a zero weight.
+            for(int b = 0; b < group.blocks; b++)
+            {
+                for(int k = 0; k < group.size; k++)
+                {
+                    for(int lane = 0; lane < BLOCK; lane++)
+                    {
+                        int i = b*BLOCK + lane;
+
+                        if(i >= count)
+                        {
+                            indices.push_back(0);
+                            weights.push_back(0);
+                            continue;
+                        }
+
+                        int tap = table.offsets[keys[first + i] & 0xffffffff] + k;
+                        indices.push_back(vertex_slot[table.sources[tap]]);
+                        weights.push_back(table.weights[tap]);
+                    }
+                }
+            }
+
+            num_slots += group.blocks*BLOCK;
+            groups.push_back(group);
+
+            first = last;
+        }
+
+        wavefronts.push_back(groups.size());
+    }
+
+    void StencilEvaluator::Apply(float *data, int width, int stride, ThreadPool *pool)
+    {
+        if(width < 1 || width > 4)
+        {
+            throw RuntimeError("StencilEvaluator Error: Unsupported vertex width.");
+        }
+
+        if(groups.empty())
+        {
+            return;
+        }
+
+        Kernel kernel = scalarKernel;
+#ifdef GFX_SIMD_X86
+        if(mode == SSE)  kernel = sseKernel;
+        if(mode == AVX2) kernel = avx2Kernel;
+#endif
+
+        channels.resize(width*num_slots);
+
+        float *channel[4];
+        for(int c = 0; c < width; c++)
+        {
+            channel[c] = &channels[c*num_slots];
+        }
+
+        // -- Transpose the control vertices into their slots.
+        ParallelFor(pool, 0, num_control, VERTEX_GRAIN, [&](int begin, int end)
+        {
+            for(int v = begin; v < end; v++)
+            {
+                for(int c = 0; c < width; c++)
+                {
+                    channel[c][v] = data[v*stride + c];
+                }
+            }
+        });
+
+        // -- Evaluate the wavefronts in order, splitting each one by block.
+        for(size_t w = 0; w + 1 < wavefronts.size(); w++)
+        {
+            int first_group = wavefronts[w];
+            int last_group  = wavefronts[w + 1];
+
+            const Group &last = groups[last_group - 1];
+            int num_blocks = last.block + last.blocks;
+
+            ParallelFor(pool, 0, num_blocks, BLOCK_GRAIN, [&](int begin, int end)
+            {
+                for(int g = first_group; g < last_group; g++)
+                {
+                    const Group &group = groups[g];
+
+                    int first_block = std::max(begin, group.block) - group.block;
+                    int last_block  = std::min(end, group.block + group.blocks) - group.block;
+
+                    if(first_block >= last_block)
+                    {
+                        continue;
+                    }
+
+                    int tap = group.taps + first_block*group.size*BLOCK;
+                    kernel(&indices[tap], &weights[tap], group.size, last_block - first_block,
+                           channel, width, group.slot + first_block*BLOCK);
+                }
+            });
+        }
+
+        // -- Transpose the derived vertices back.
+        ParallelFor(pool, 0, num_slots - num_control, VERTEX_GRAIN, [&](int begin, int end)
+        {
+            for(int s = begin; s < end; s++)
+            {
+                int v = slot_vertex[s];
+                if(v == -1)
+                {
+                    continue;
+                }
+
+                for(int c = 0; c < width; c++)
+                {
+                    data[v*stride + c] = channel[c][num_control + s];
+                }
+            }
+        });
+    }
+
+    /* end */
+}
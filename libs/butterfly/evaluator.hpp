@@ -0,0 +1,90 @@
+#ifndef __GFX_EVALUATOR_HPP
+#define __GFX_EVALUATOR_HPP
+
+#include <vector>
+#include "stencil.hpp"
+#include "thread_pool.hpp"
+
+namespace gfx
+{
+
+/* Evaluates a StencilTable on structure of arrays data with SIMD kernels.
+ *
+ * Compile() sorts the rows of the table into wavefronts, where every row only depends on rows of earlier
+ * wavefronts, and groups the rows of each wavefront by stencil size. Each group is stored in blocks of
+ * 8 rows with the source indices and weights of a block interleaved per tap, so a kernel evaluates
+ * 8 stencils at once with one gather per tap and channel.
+ *
+ * The vertices are renumbered into slots in evaluation order, so every block writes 8 consecutive floats
+ * of each channel. Apply() transposes the control vertices into the slots, runs the kernels
+ * and transposes the results back.
+ *
+ * The wavefronts run one after another. Given a thread pool, the blocks of a wavefront are split between
+ * its threads, and the transposes are split by vertex.
+ *
+ * Every kernel accumulates in the same order with separate multiplies and adds,
+ * so all of the modes give the same results as StencilTable::Apply().
+ */
+class StencilEvaluator
+{
+public:
+    enum Mode {SCALAR, SSE, AVX2};
+
+    StencilEvaluator();
+
+    // Builds the batched layout of the table.
+    void Compile(const StencilTable &table);
+
+    // Same contract as StencilTable::Apply(). Not thread safe, the evaluator owns the SoA buffers.
+    void Apply(float *data, int width, int stride, ThreadPool *pool = NULL);
+
+    // The fastest mode supported by the running processor.
+    static Mode BestMode();
+
+    Mode GetMode() const { return mode; }
+
+    // Modes that the processor does not support fall back to the best supported mode.
+    void SetMode(Mode requested);
+
+    int NumVertices() const { return num_vertices; }
+
+    static const int BLOCK = 8;
+
+private:
+
+    // The rows of one wavefront that have the same stencil size.
+    struct Group
+    {
+        int wavefront;
+        int size;   // Taps per row.
+        int slot;   // Slot of the first row.
+        int blocks; // Blocks of BLOCK rows, the last one is padded.
+        int taps;   // Offset of the first tap in indices and weights.
+        int block;  // Index of the first block within the wavefront.
+    };
+
+    Mode mode;
+
+    int num_control;
+    int num_vertices;
+    int num_slots;
+
+    std::vector<Group> groups;
+
+    // The first group of every wavefront, followed by groups.size().
+    std::vector<int> wavefronts;
+
+    // Per tap, BLOCK lanes each : source slots and weights.
+    std::vector<int>   indices;
+    std::vector<float> weights;
+
+    // The vertex stored in every derived slot, -1 for padding.
+    std::vector<int> slot_vertex;
+
+    // Channel major SoA storage, num_slots floats per channel.
+    std::vector<float> channels;
+};
+
+/* end */
+}
+#endif
@@ -1,1143 +1,1561 @@
 #include <assert.h>
+#include <algorithm>
 #include <iostream>
+#include <queue>
 #include "mesh.hpp"
 #include "error.hpp"
-#include <sys/time.h>
+#include "profile.hpp"
 
 namespace gfx
 {
-    
-    Vertex WingedEdge::AddVertex(GLfloat x, GLfloat y, GLfloat z)
+
+    // Fills the first free slot of a vertex's pair of boundary neighbours.
+    static void addBoundaryNeighbor(int *slot, int v)
     {
-        Vertex v(x, y, z);
-        vertexList[v]; /* ensure the key exists */
-        return v;
+        if(slot[0] == -1)
+        {
+            slot[0] = v;
+        }
+        else if(slot[1] == -1)
+        {
+            slot[1] = v;
+        }
     }
-    
-    Edge WingedEdge::AddEdge(const Edge& e)
+
+    int WingedEdge::AddVertex(float x, float y, float z)
     {
-        return AddEdge(e.V1(), e.V2());
+        return AddVertex(Vertex(x, y, z));
     }
-    
-    Edge WingedEdge::AddEdge(const Vertex& v1, const Vertex& v2)
+
+    int WingedEdge::AddVertex(const Vertex& v)
     {
-        Edge e(v1, v2);
-        
-        /* get them in the vertexList */
-        
-        vertexList[v1].insert(e);
-        vertexList[v2].insert(e);
-        
-        /* setup edge list */
-        edgeListMap[e].edges.insert(e);
-        edgeListMap[e].vertices.insert(v1);
-        edgeListMap[e].vertices.insert(v2);
-        
-        return e;
+        vertices.push_back(v);
+        return vertices.size() - 1;
+    }
+
+    int WingedEdge::AddFace(int v1, int v2, int v3)
+    {
+        if(v1 == v2 || v2 == v3 || v3 == v1)
+        {
+            return -1;
+        }
+
+        int face  = NumFaces();
+        int first = 3*face;
+
+        HalfEdge h;
+        h.twin = -1;
+        h.edge = -1;
+
+        h.vertex = v1; h.next = first + 1; halfEdges.push_back(h);
+        h.vertex = v2; h.next = first + 2; halfEdges.push_back(h);
+        h.vertex = v3; h.next = first + 0; halfEdges.push_back(h);
+
+        return face;
+    }
+
+    /* Matches every half edge with the other half edges that share its end points.
+     * The half edges are bucketed by their lowest vertex with a counting sort,
+     * so each half edge is only compared against the few edges that leave the same vertex.
+     */
+    void WingedEdge::BuildTopology()
+    {
+        SubdivisionScratch scratch;
+        BuildTopology(scratch);
+    }
+
+    void WingedEdge::BuildTopology(SubdivisionScratch &scratch)
+    {
+        GFX_PROFILE_SCOPE("build_topology");
+
+        int num_vertices   = NumVertices();
+        int num_half_edges = halfEdges.size();
+
+        edgeHalfEdge.clear();
+        edgeFaces.clear();
+        boundaryNeighbors.assign(2*num_vertices, -1);
+
+        // -- Bucket the half edges by their lowest vertex.
+        std::vector<int> &offsets = scratch.offsets;
+        offsets.assign(num_vertices + 1, 0);
+
+        for(int h = 0; h < num_half_edges; h++)
+        {
+            int a = halfEdges[h].vertex;
+            int b = halfEdges[Next(h)].vertex;
+            offsets[(a < b ? a : b) + 1]++;
+        }
+
+        for(int v = 0; v < num_vertices; v++)
+        {
+            offsets[v + 1] += offsets[v];
+        }
+
+        std::vector<int> &bucket = scratch.bucket;
+        std::vector<int> &fill   = scratch.fill;
+        bucket.resize(num_half_edges);
+        fill.assign(offsets.begin(), offsets.end() - 1);
+        for(int h = 0; h < num_half_edges; h++)
+        {
+            int a = halfEdges[h].vertex;
+            int b = halfEdges[Next(h)].vertex;
+            bucket[fill[a < b ? a : b]++] = h;
+        }
+
+        // -- Match the half edges within each bucket.
+        for(int v = 0; v < num_vertices; v++)
+        {
+            for(int i = offsets[v]; i < offsets[v + 1]; i++)
+            {
+                int h  = bucket[i];
+                int hi = halfEdges[h].vertex + halfEdges[Next(h)].vertex - v;
+
+                HalfEdge &half = halfEdges[h];
+
+                for(int j = offsets[v]; j < i; j++)
+                {
+                    int g = bucket[j];
+
+                    if(halfEdges[g].vertex + halfEdges[Next(g)].vertex - v != hi)
+                    {
+                        continue;
+                    }
+
+                    // Pair with the first half edge on the edge.
+                    int e = halfEdges[g].edge;
+                    half.edge = e;
+
+                    int first = edgeHalfEdge[e];
+                    half.twin = first;
+                    if(halfEdges[first].twin == -1)
+                    {
+                        halfEdges[first].twin = h;
+                    }
+
+                    edgeFaces[e]++;
+                    break;
+                }
+
+                if(half.edge == -1)
+                {
+                    half.edge = edgeHalfEdge.size();
+                    edgeHalfEdge.push_back(h);
+                    edgeFaces.push_back(1);
+                }
+            }
+        }
+
+        // -- Record the boundary neighbours of every vertex.
+        int num_edges = NumEdges();
+        for(int e = 0; e < num_edges; e++)
+        {
+            if(!IsBoundaryEdge(e))
+            {
+                continue;
+            }
+
+            int h = edgeHalfEdge[e];
+            int a = halfEdges[h].vertex;
+            int b = halfEdges[Next(h)].vertex;
+
+            addBoundaryNeighbor(&boundaryNeighbors[2*a], b);
+            addBoundaryNeighbor(&boundaryNeighbors[2*b], a);
+        }
     }
-    
-    Face WingedEdge::AddFace(const Edge& e1, const Edge& e2, const Edge& e3)
+
+    void WingedEdge::Clear()
     {
-        Face f(e1, e2, e3);
-        
-        /* ensure below */
-        AddEdge(e1.V1(), e1.V2());
-        AddEdge(e2.V1(), e2.V2());
-        AddEdge(e3.V1(), e3.V2());
-        
-        /* edit face lists */
-        faceList[f].insert(e1);
-        faceList[f].insert(e2);
-        faceList[f].insert(e3);
-        
-        edgeListMap[e1].faces.insert(f);
-        edgeListMap[e2].faces.insert(f);
-        edgeListMap[e3].faces.insert(f);
-        
-        edgeListMap[e1].vertices.insert(e1.V1());
-        edgeListMap[e1].vertices.insert(e1.V2());
-        edgeListMap[e2].vertices.insert(e2.V1());
-        edgeListMap[e2].vertices.insert(e2.V2());
-        edgeListMap[e3].vertices.insert(e3.V1());
-        edgeListMap[e3].vertices.insert(e3.V2());
-
-        return f;
+        vertices.clear();
+        halfEdges.clear();
+        edgeHalfEdge.clear();
+        edgeFaces.clear();
+        boundaryNeighbors.clear();
     }
-    
-    void WingedEdge::Draw()
+
+    void WingedEdge::swap(WingedEdge &mesh)
     {
-        for (auto it = edgeListMap.begin(); it != edgeListMap.end(); ++it)
-            it->first.Draw();
+        vertices.swap(mesh.vertices);
+        halfEdges.swap(mesh.halfEdges);
+        edgeHalfEdge.swap(mesh.edgeHalfEdge);
+        edgeFaces.swap(mesh.edgeFaces);
+        boundaryNeighbors.swap(mesh.boundaryNeighbors);
     }
-    
-    // Interface function, performs butterfly subdivision that does not account for the internal special cases.
-    // The subdivision only accounts for the boundaries and 6 regular vertices.
-    WingedEdge WingedEdge::ButterflySubdivide()
+
+    // Interface function, performs the modified butterfly subdivision, see EdgeStencil() for its rules.
+    WingedEdge WingedEdge::ButterflySubdivide(ThreadPool *pool)
     {
-        return Subdivide(false, false);
+        WingedEdge mesh;
+        SubdivisionScratch scratch;
+        Subdivide(false, false, mesh, scratch, NULL, pool);
+        return mesh;
     }
-    
+
     // Interface function, performs linear subdivision on the mesh.
-    WingedEdge WingedEdge::LinearSubdivide()
+    WingedEdge WingedEdge::LinearSubdivide(ThreadPool *pool)
     {
-        return Subdivide(true, false);
+        WingedEdge mesh;
+        SubdivisionScratch scratch;
+        Subdivide(true, false, mesh, scratch, NULL, pool);
+        return mesh;
     }
-    
+
     // -- A whimsical subdivision that creates pascal's triangle like structures.
-    WingedEdge WingedEdge::SillyPascalSubdivide()
+    WingedEdge WingedEdge::SillyPascalSubdivide(ThreadPool *pool)
     {
-        return Subdivide(false, true);
+        WingedEdge mesh;
+        SubdivisionScratch scratch;
+        Subdivide(false, true, mesh, scratch, NULL, pool);
+        return mesh;
     }
-    
+
     // Subdivides only the edges on the boundary.
     WingedEdge WingedEdge::BoundaryTrianglularSubdivide(float min_len)
     {
-        
-        WingedEdge mesh;// = *this;
+        WingedEdge mesh;
+        SubdivisionScratch scratch;
+        BoundarySubdivide(min_len, mesh, scratch, NULL);
+        return mesh;
+    }
+
+    // -- Derivation recording interface functions.
+    WingedEdge WingedEdge::ButterflySubdivide(Derivations &derivations, ThreadPool *pool)
+    {
+        WingedEdge mesh;
+        SubdivisionScratch scratch;
+        Subdivide(false, false, mesh, scratch, &derivations, pool);
+        return mesh;
+    }
+
+    WingedEdge WingedEdge::LinearSubdivide(Derivations &derivations, ThreadPool *pool)
+    {
+        WingedEdge mesh;
+        SubdivisionScratch scratch;
+        Subdivide(true, false, mesh, scratch, &derivations, pool);
+        return mesh;
+    }
+
+    WingedEdge WingedEdge::SillyPascalSubdivide(Derivations &derivations, ThreadPool *pool)
+    {
+        WingedEdge mesh;
+        SubdivisionScratch scratch;
+        Subdivide(false, true, mesh, scratch, &derivations, pool);
+        return mesh;
+    }
+
+    WingedEdge WingedEdge::AdaptiveButterflySubdivide(float tolerance, float max_len, int max_faces, ThreadPool *pool)
+    {
+        WingedEdge mesh;
+        SubdivisionScratch scratch;
+        AdaptiveSubdivide(tolerance, max_len, max_faces, mesh, scratch, NULL, pool);
+        return mesh;
+    }
+
+    WingedEdge WingedEdge::AdaptiveButterflySubdivide(Derivations &derivations, float tolerance, float max_len, int max_faces,
+                                                      ThreadPool *pool)
+    {
+        WingedEdge mesh;
+        SubdivisionScratch scratch;
+        AdaptiveSubdivide(tolerance, max_len, max_faces, mesh, scratch, &derivations, pool);
+        return mesh;
+    }
+
+    WingedEdge WingedEdge::BoundaryRefine(float precision, int max_vertices)
+    {
+        WingedEdge mesh;
+        SubdivisionScratch scratch;
+        RefineBoundary(precision, max_vertices, mesh, scratch, NULL);
+        return mesh;
+    }
+
+    WingedEdge WingedEdge::BoundaryRefine(Derivations &derivations, float precision, int max_vertices)
+    {
+        WingedEdge mesh;
+        SubdivisionScratch scratch;
+        RefineBoundary(precision, max_vertices, mesh, scratch, &derivations);
+        return mesh;
+    }
+
+    // Subdivides all edges on the boundary. Populates information about the vertices that were subdivided.
+    WingedEdge WingedEdge::BoundaryTrianglularSubdivide(Derivations &derivations, float min_len)
+    {
+        WingedEdge mesh;
+        SubdivisionScratch scratch;
+        BoundarySubdivide(min_len, mesh, scratch, &derivations);
+        return mesh;
+    }
+
+    // -- Interface functions that subdivide into a given mesh.
+    void WingedEdge::ButterflySubdivide(WingedEdge &mesh, SubdivisionScratch &scratch, Derivations *derivations, ThreadPool *pool)
+    {
+        Subdivide(false, false, mesh, scratch, derivations, pool);
+    }
+
+    void WingedEdge::LinearSubdivide(WingedEdge &mesh, SubdivisionScratch &scratch, Derivations *derivations, ThreadPool *pool)
+    {
+        Subdivide(true, false, mesh, scratch, derivations, pool);
+    }
+
+    void WingedEdge::SillyPascalSubdivide(WingedEdge &mesh, SubdivisionScratch &scratch, Derivations *derivations, ThreadPool *pool)
+    {
+        Subdivide(false, true, mesh, scratch, derivations, pool);
+    }
+
+    void WingedEdge::BoundaryTrianglularSubdivide(WingedEdge &mesh, SubdivisionScratch &scratch, Derivations *derivations,
+                                                  float min_len)
+    {
+        BoundarySubdivide(min_len, mesh, scratch, derivations);
+    }
+
+    void WingedEdge::AdaptiveButterflySubdivide(WingedEdge &mesh, SubdivisionScratch &scratch, Derivations *derivations,
+                                                float tolerance, float max_len, int max_faces, ThreadPool *pool)
+    {
+        AdaptiveSubdivide(tolerance, max_len, max_faces, mesh, scratch, derivations, pool);
+    }
+
+    void WingedEdge::BoundaryRefine(WingedEdge &mesh, SubdivisionScratch &scratch, Derivations *derivations,
+                                    float precision, int max_vertices)
+    {
+        RefineBoundary(precision, max_vertices, mesh, scratch, derivations);
+    }
+
+
+    // -- Internal subdivision work functions.
+
+    void WingedEdge::BoundarySubdivide(float min_len, WingedEdge &mesh, SubdivisionScratch &scratch, Derivations *derivations)
+    {
+        GFX_PROFILE_SCOPE("boundary_subdivide");
 
-        
-        for (auto face_iter = faceList.begin(); face_iter != faceList.end(); ++face_iter)
+        mesh.Clear();
+        mesh.vertices.assign(vertices.begin(), vertices.end());
+
+        float sqr_len_min = min_len > 1 ? min_len*min_len : min_len;
+
+        // -- Decide which boundary edges are split.
+        int num_edges = NumEdges();
+        std::vector<int> &split = scratch.split;
+        split.assign(num_edges, -1);
+        Stencil stencil;
+
+        for(int e = 0; e < num_edges; e++)
         {
-            const Face face = face_iter -> first;
-            
-            
-            /* massive assumption that there is 3 edges in our face */
-            Edge e1 = face.E1();
-            Edge e2 = face.E2();
-            Edge e3 = face.E3();
-            
-            // Compute the vertices opposite the cooresponding indiced edges.
-            bool success = true;
-            Vertex v1 = GetAdjacentVertex(face, e1, success);
-            Vertex v2 = GetAdjacentVertex(face, e2, success);
-            Vertex v3 = GetAdjacentVertex(face, e3, success);
-            
-            if(!success)
+            if(!IsBoundaryEdge(e))
             {
-                throw new RuntimeError("Error : Winged Edge topology is malformed!");
-            }
-            
-            // -- Compute boundary predicates that answer whether or not an edge should be divided.
-            bool b1, b2, b3;
-            b1 = getNumAdjacentFaces(e1) == 1;
-            b2 = getNumAdjacentFaces(e2) == 1;
-            b3 = getNumAdjacentFaces(e3) == 1;
-            
-            // Non Boundary --> do not subdivide the face.
-            if(!(b1 || b2 || b3))
-            {
-                
-                e1 = mesh.AddEdge(e1);
-                e2 = mesh.AddEdge(e2);
-                e2 = mesh.AddEdge(e2);
-                
-                mesh.AddFace(e1, e2, e3);
-                
                 continue;
             }
-            
-            
-            // FIXME : Only compute butterfly midpoints, if the original predicate is true.
-            
-            // Compute interpolated midpoints.
-            Vertex mid_b1, mid_b2, mid_b3;
-            mid_b1 = SubdivideEdge(face, e1, v1, false);
-            mid_b2 = SubdivideEdge(face, e2, v2, false);
-            mid_b3 = SubdivideEdge(face, e3, v3, false);
-            
-            
+
+            split[e] = edgeHalfEdge[e];
+
             // Bound the change in midpoint.
             if(min_len > 0)
             {
-                // Compute linear mid points.
-                Vertex mid_l1, mid_l2, mid_l3;
-                mid_l1 = SubdivideEdge(face, e1, v1, true);
-                mid_l2 = SubdivideEdge(face, e2, v2, true);
-                mid_l3 = SubdivideEdge(face, e3, v3, true);
-                
-                float sqr_len_min = min_len > 1 ? min_len*min_len : min_len;
-                
-                b1 = b1 && computeSqrOffset(mid_b1, mid_l1) > sqr_len_min;
-                b2 = b2 && computeSqrOffset(mid_b2, mid_l2) > sqr_len_min;
-                b3 = b3 && computeSqrOffset(mid_b3, mid_l3) > sqr_len_min;
+                BoundaryStencil(edgeHalfEdge[e], stencil);
+                Vertex mid_b = EvaluateStencil(stencil);
+
+                EdgeStencil(edgeHalfEdge[e], true, stencil);
+                Vertex mid_l = EvaluateStencil(stencil);
+
+                if(computeSqrOffset(mid_b, mid_l) <= sqr_len_min)
+                {
+                    split[e] = -1;
+                }
             }
-            
-            
-            
-            // -- Count the number of edges that are on the boundary.
+        }
+
+        // The index of the midpoint vertex of every edge, -1 if the edge has not been subdivided.
+        SubdivideEdges(split, false, mesh, scratch, derivations, NULL);
+        const std::vector<int> &midpoints = scratch.midpoints;
+
+        int num_faces = NumFaces();
+        for(int face = 0; face < num_faces; face++)
+        {
+            int first = 3*face;
+
+            // Corners and the predicates that answer whether or not the edge starting at the corner should be divided.
+            int  v[3];
+            bool b[3];
+            int  mid[3];
+
             int boundary_count = 0;
-            boundary_count = b1 ? boundary_count + 1 : boundary_count;
-            boundary_count = b2 ? boundary_count + 1 : boundary_count;
-            boundary_count = b3 ? boundary_count + 1 : boundary_count;
-     
+
+            for(int i = 0; i < 3; i++)
+            {
+                const HalfEdge &half = halfEdges[first + i];
+
+                v[i]   = half.vertex;
+                mid[i] = midpoints[half.edge];
+                b[i]   = mid[i] != -1;
+
+                if(b[i])
+                {
+                    boundary_count++;
+                }
+            }
+
             // Non Boundary --> do not subdivide the face.
             if(boundary_count == 0)
             {
-                e1 = mesh.AddEdge(e1);
-                e2 = mesh.AddEdge(e2);
-                e2 = mesh.AddEdge(e2);
-                
-                mesh.AddFace(e1, e2, e3);
+                mesh.AddFace(v[0], v[1], v[2]);
+                continue;
+            }
+
+            // 3 boundaries. Perform the full 4 face triangulation.
+            if(boundary_count == 3)
+            {
+                performTriangulation(mesh,
+                                     v[0], v[1], v[2],
+                                     mid[0], mid[1], mid[2]);
                 continue;
             }
-            
-            
-            // 1 boundary --> subdivide into 2 vertices.
+
+            // 1 boundary --> split the face from the opposite corner to the new vertex.
             if(boundary_count == 1)
             {
-                
-                Vertex v_new, v_old1, v_old2, v_old3;
-                
-                if(b1)
+                int i = b[0] ? 0 : (b[1] ? 1 : 2);
+                int j = (i + 1) % 3;
+                int k = (i + 2) % 3;
+
+                mesh.AddFace(v[i], mid[i], v[k]);
+                mesh.AddFace(mid[i], v[j], v[k]);
+                continue;
+            }
+
+            // -- 2 boundary case. Subdivide into 3 triangles.
+            // The edge i --> j is kept, the edges j --> k and k --> i are split.
+            int i = !b[0] ? 0 : (!b[1] ? 1 : 2);
+            int j = (i + 1) % 3;
+            int k = (i + 2) % 3;
+
+            // Constant edge triangle.
+            mesh.AddFace(v[i], v[j], mid[j]);
+
+            // Boundary triangles.
+            mesh.AddFace(v[i], mid[j], mid[k]);
+            mesh.AddFace(mid[j], v[k], mid[k]);
+        }
+
+        mesh.BuildTopology(scratch);
+    }
+
+    // A boundary edge of RefineBoundary(), waiting in the queue with the deviation of its midpoint.
+    struct BoundarySegment
+    {
+        float deviation;
+        int   point;
+        int   version;
+
+        // The largest deviation first, ties in point order.
+        bool operator<(const BoundarySegment &s) const
+        {
+            return deviation < s.deviation || (deviation == s.deviation && point > s.point);
+        }
+    };
+
+    /* Triangulates the polygon by walking two chains from its edge polygon[0], polygon[1] towards polygon[split] :
+     * forwards from polygon[1] and backwards from polygon[0], always advancing the chain with the shorter next diagonal.
+     * The triangles keep the orientation of the polygon.
+     */
+    static void stitchPolygon(WingedEdge &mesh, const std::vector<int> &polygon, int split)
+    {
+        int n = polygon.size();
+        int a = 1;
+        int b = 0;
+        int b_end = (split + 1) % n;
+
+        for(;;)
+        {
+            int next_b = b == 0 ? n - 1 : b - 1;
+
+            bool advance_a = a < split;
+            bool advance_b = b != b_end;
+
+            if(!advance_a && !advance_b)
+            {
+                break;
+            }
+
+            if(advance_a && advance_b)
+            {
+                const Vertex &pa = mesh.vertices[polygon[a]];
+                const Vertex &pb = mesh.vertices[polygon[b]];
+                Vertex da = mesh.vertices[polygon[a + 1]] - pb;
+                Vertex db = mesh.vertices[polygon[next_b]] - pa;
+
+                advance_a = da.X()*da.X() + da.Y()*da.Y() + da.Z()*da.Z() <= db.X()*db.X() + db.Y()*db.Y() + db.Z()*db.Z();
+            }
+
+            if(advance_a)
+            {
+                mesh.AddFace(polygon[a], polygon[a + 1], polygon[b]);
+                a++;
+            }
+            else
+            {
+                mesh.AddFace(polygon[a], polygon[next_b], polygon[b]);
+                b = next_b;
+            }
+        }
+    }
+
+    void WingedEdge::RefineBoundary(float precision, int max_vertices, WingedEdge &mesh, SubdivisionScratch &scratch,
+                                    Derivations *derivations)
+    {
+        if(precision <= 0)
+        {
+            throw RuntimeError("WingedEdge Error: The boundary refinement precision must be positive.");
+        }
+
+        GFX_PROFILE_SCOPE("refine_boundary");
+
+        mesh.Clear();
+        mesh.vertices.assign(vertices.begin(), vertices.end());
+
+        int num_old = NumVertices();
+        float sqr_precision = precision*precision;
+
+        // -- Every boundary half edge holds a chain of points from its origin to its end, linked both ways.
+        std::vector<int> point_vertex, point_prev, point_next, point_edge, point_version;
+        std::vector<int> head(halfEdges.size(), -1);
+        std::vector<int> tail(halfEdges.size(), -1);
+
+        for(int e = 0; e < NumEdges(); e++)
+        {
+            if(!IsBoundaryEdge(e))
+            {
+                continue;
+            }
+
+            int h     = edgeHalfEdge[e];
+            int first = point_vertex.size();
+
+            head[h] = first;
+            tail[h] = first + 1;
+
+            int ends[2] = {halfEdges[h].vertex, halfEdges[Next(h)].vertex};
+            for(int i = 0; i < 2; i++)
+            {
+                point_vertex.push_back(ends[i]);
+                point_prev.push_back(i == 0 ? -1 : first);
+                point_next.push_back(i == 0 ? first + 1 : -1);
+                point_edge.push_back(h);
+                point_version.push_back(0);
+            }
+        }
+
+        // The boundary half edges at every old vertex, for boundaries that do not follow the orientation of the faces.
+        std::vector<int> vertex_chains(2*num_old, -1);
+
+        for(size_t h = 0; h < halfEdges.size(); h++)
+        {
+            if(head[h] != -1)
+            {
+                addBoundaryNeighbor(&vertex_chains[2*halfEdges[h].vertex], h);
+                addBoundaryNeighbor(&vertex_chains[2*halfEdges[Next(h)].vertex], h);
+            }
+        }
+
+        // The chain that continues the chain of h beyond its end point v, or -1.
+        auto neighbor_chain = [&](int h, int v) -> int
+        {
+            int g = v == halfEdges[h].vertex ? PreviousBoundaryEdge(h) : NextBoundaryEdge(h);
+
+            if(g != -1 && head[g] != -1)
+            {
+                return g;
+            }
+
+            for(int i = 0; i < 2; i++)
+            {
+                g = vertex_chains[2*v + i];
+
+                if(g != -1 && g != h)
+                {
+                    return g;
+                }
+            }
+
+            return -1;
+        };
+
+        // The segment of the chain g at its end point v, and the point next to v.
+        auto end_segment = [&](int g, int v) -> int
+        {
+            return point_vertex[head[g]] == v ? head[g] : point_prev[tail[g]];
+        };
+
+        auto end_neighbor = [&](int g, int v) -> int
+        {
+            return point_vertex[head[g]] == v ? point_next[head[g]] : point_prev[tail[g]];
+        };
+
+        // The boundary vertices before and after a point, continuing into the neighbouring chains like BoundaryStencil().
+        auto before = [&](int p) -> int
+        {
+            if(point_prev[p] != -1)
+            {
+                return point_vertex[point_prev[p]];
+            }
+
+            int h = point_edge[p];
+            int g = neighbor_chain(h, point_vertex[p]);
+
+            return g != -1 ? point_vertex[end_neighbor(g, point_vertex[p])]
+                           : getOtherBoundaryVertice(halfEdges[h].vertex, halfEdges[Next(h)].vertex);
+        };
+
+        auto after = [&](int p) -> int
+        {
+            if(point_next[p] != -1)
+            {
+                return point_vertex[point_next[p]];
+            }
+
+            int h = point_edge[p];
+            int g = neighbor_chain(h, point_vertex[p]);
+
+            return g != -1 ? point_vertex[end_neighbor(g, point_vertex[p])]
+                           : getOtherBoundaryVertice(halfEdges[Next(h)].vertex, halfEdges[h].vertex);
+        };
+
+        // The 4 point stencil of the segment from p to the next point, and the squared distance to the linear midpoint.
+        Stencil stencil;
+
+        auto measure = [&](int p) -> float
+        {
+            int q = point_next[p];
+
+            stencil.Clear();
+            stencil.Add(point_vertex[p], 9/16.0f);
+            stencil.Add(point_vertex[q], 9/16.0f);
+            stencil.Add(before(p), -1/16.0f);
+            stencil.Add(after(q), -1/16.0f);
+
+            Vertex mid(0, 0, 0);
+            for(int k = 0; k < stencil.Size(); k++)
+            {
+                mid = mid + mesh.vertices[stencil.sources[k]]*stencil.weights[k];
+            }
+
+            Vertex linear = (mesh.vertices[point_vertex[p]] + mesh.vertices[point_vertex[q]])*0.5f;
+            return computeSqrOffset(mid, linear);
+        };
+
+        // The segments before and after the segment from p, or -1.
+        auto segment_before = [&](int p) -> int
+        {
+            if(point_prev[p] != -1)
+            {
+                return point_prev[p];
+            }
+
+            int g = neighbor_chain(point_edge[p], point_vertex[p]);
+            return g != -1 ? end_segment(g, point_vertex[p]) : -1;
+        };
+
+        auto segment_after = [&](int p) -> int
+        {
+            int q = point_next[p];
+
+            if(point_next[q] != -1)
+            {
+                return q;
+            }
+
+            int g = neighbor_chain(point_edge[p], point_vertex[q]);
+            return g != -1 ? end_segment(g, point_vertex[q]) : -1;
+        };
+
+        std::priority_queue<BoundarySegment> queue;
+
+        auto update = [&](int p)
+        {
+            if(p != -1 && point_next[p] != -1)
+            {
+                BoundarySegment segment = {measure(p), p, ++point_version[p]};
+                queue.push(segment);
+            }
+        };
+
+        for(size_t p = 0; p < point_vertex.size(); p++)
+        {
+            update(p);
+        }
+
+        // The number of times the segment from every point has been halved.
+        std::vector<int> point_level(point_vertex.size(), 0);
+
+        // The derivations of the new vertices, in terms of the old vertices.
+        std::vector<Stencil> expanded;
+
+        // Adds the midpoint of the segment from p, and measures the segments whose 4 points have changed.
+        auto split = [&](int p)
+        {
+            measure(p);
+
+            Vertex mid(0, 0, 0);
+            for(int k = 0; k < stencil.Size(); k++)
+            {
+                mid = mid + mesh.vertices[stencil.sources[k]]*stencil.weights[k];
+            }
+
+            int v = mesh.AddVertex(mid);
+
+            if(derivations != NULL)
+            {
+                Stencil derivation;
+
+                for(int k = 0; k < stencil.Size(); k++)
                 {
-                    v_new = mid_b1;
-                    v_old1 = v1;
-                    v_old2 = v2;
-                    v_old3 = v3;
+                    int   source = stencil.sources[k];
+                    float weight = stencil.weights[k];
+
+                    if(source < num_old)
+                    {
+                        derivation.Add(source, weight);
+                        continue;
+                    }
+
+                    const Stencil &inner = expanded[source - num_old];
+                    for(int j = 0; j < inner.Size(); j++)
+                    {
+                        derivation.Add(inner.sources[j], inner.weights[j]*weight);
+                    }
                 }
-                else if(b2)
+
+                expanded.push_back(Stencil());
+                expanded.back().swap(derivation);
+            }
+
+            // -- Link the new point between p and q.
+            int q = point_next[p];
+            int m = point_vertex.size();
+
+            point_vertex.push_back(v);
+            point_prev.push_back(p);
+            point_next.push_back(q);
+            point_edge.push_back(point_edge[p]);
+            point_version.push_back(0);
+            point_level.push_back(++point_level[p]);
+
+            point_next[p] = m;
+            point_prev[q] = m;
+
+            update(p);
+            update(m);
+            update(segment_before(p));
+            update(segment_after(m));
+        };
+
+        /* -- Split the worst segment until every segment is within the precision.
+         * The 4 point rule only converges if neighbouring segments are about the same length,
+         * so coarser neighbours of a segment are split before it, which keeps their levels within one of each other.
+         */
+        std::vector<std::pair<int, int> > pending;
+
+        while(!queue.empty())
+        {
+            BoundarySegment segment = queue.top();
+            queue.pop();
+
+            if(segment.version != point_version[segment.point])
+            {
+                continue;
+            }
+
+            if(segment.deviation <= sqr_precision)
+            {
+                break;
+            }
+
+            pending.assign(1, std::make_pair(segment.point, point_level[segment.point]));
+
+            while(!pending.empty() && (max_vertices < 0 || mesh.NumVertices() < max_vertices))
+            {
+                int p     = pending.back().first;
+                int level = pending.back().second;
+
+                // Already split through a neighbour.
+                if(point_level[p] != level)
                 {
-                    v_new = mid_b2;
-                    v_old1 = v2;
-                    v_old2 = v3;
-                    v_old3 = v1;
+                    pending.pop_back();
+                    continue;
                 }
-                else
+
+                int before_p = segment_before(p);
+                int after_p  = segment_after(p);
+
+                if(before_p != -1 && point_level[before_p] < level)
                 {
-                    v_new = mid_b3;
-                    v_old1 = v3;
-                    v_old2 = v1;
-                    v_old3 = v2;
+                    pending.push_back(std::make_pair(before_p, point_level[before_p]));
+                    continue;
                 }
-                
-                // face1
-                e1 = mesh.AddEdge(v_new, v_old1);
-                e2 = mesh.AddEdge(v_new, v_old2);
-                e3 = mesh.AddEdge(v_old1, v_old2);
-                mesh.AddFace(e1, e2, e3);
-                
-                // Face 2.
-                e2 = mesh.AddEdge(v_new, v_old3);
-                e3 = mesh.AddEdge(v_old1, v_old3);
-                mesh.AddFace(e1, e2, e3);
-                
-                continue;
+
+                if(after_p != -1 && point_level[after_p] < level)
+                {
+                    pending.push_back(std::make_pair(after_p, point_level[after_p]));
+                    continue;
+                }
+
+                pending.pop_back();
+                split(p);
             }
-            
-            // 2 - 3 boundaries. Perform the full 4 face triangulation.
-            
-            if(boundary_count == 3)
+
+            if(max_vertices >= 0 && mesh.NumVertices() >= max_vertices)
             {
-                performTriangulation(mesh,
-                                     v1, v2, v3,
-                                     mid_b1, mid_b2, mid_b3);
-                
-                continue;
+                break;
             }
-            
-            if(boundary_count > 3)
+        }
+
+        for(size_t i = 0; i < expanded.size(); i++)
+        {
+            AddDerivation(*derivations, num_old + i) = expanded[i];
+        }
+
+        // -- Keep the interior faces, fan the faces with one refined edge from the opposite corner
+        //    and stitch the faces with more refined edges between their edges.
+        std::vector<int> polygon;
+        int num_faces = NumFaces();
+
+        for(int face = 0; face < num_faces; face++)
+        {
+            int first = 3*face;
+            int refined = 0;
+            int refined_side = 0;
+            int unrefined_side = 0;
+
+            for(int i = 0; i < 3; i++)
             {
-                throw new RuntimeError("Face has more than 3 edges. This is not a triangle!");
+                int h = first + i;
+
+                if(head[h] != -1 && point_next[head[h]] != tail[h])
+                {
+                    refined++;
+                    refined_side = i;
+                }
+                else
+                {
+                    unrefined_side = i;
+                }
             }
-            
-            // -- 2 boundary case. Subdivide into 3 triangles.
-            Vertex v_new1, v_new2, v_old1, v_old2, v_old3;
-            
-            if(!b1)
+
+            if(refined == 0)
             {
-                v_old1 = v1;
-                v_old2 = v2;
-                v_old3 = v3;
-                v_new1 = mid_b2;
-                v_new2 = mid_b3;
+                mesh.AddFace(FaceVertex(face, 0), FaceVertex(face, 1), FaceVertex(face, 2));
+                continue;
             }
-            else if(!b2)
+
+            // -- The corners and the refined points in order.
+            // A single refined side comes last, otherwise an unrefined side comes first if there is one.
+            int start = refined == 1 ? (refined_side + 1) % 3 : (refined == 2 ? unrefined_side : 0);
+
+            polygon.clear();
+            int split = 0;
+
+            for(int k = 0; k < 3; k++)
             {
-                v_old1 = v2;
-                v_old2 = v3;
-                v_old3 = v1;
-                v_new1 = mid_b3;
-                v_new2 = mid_b1;
+                int i = (start + k) % 3;
+                int h = first + i;
+
+                if(k == 2)
+                {
+                    split = polygon.size();
+                }
+
+                polygon.push_back(halfEdges[h].vertex);
+
+                for(int p = head[h] == -1 ? -1 : point_next[head[h]]; p != -1 && p != tail[h]; p = point_next[p])
+                {
+                    polygon.push_back(point_vertex[p]);
+                }
             }
-            else
+
+            if(refined == 1)
             {
-                v_old1 = v3;
-                v_old2 = v1;
-                v_old3 = v2;
-                v_new1 = mid_b1;
-                v_new2 = mid_b2;
+                // Fan the points from polygon[split] around to polygon[0] from the opposite corner polygon[1].
+                for(int i = split; i < (int)polygon.size(); i++)
+                {
+                    mesh.AddFace(polygon[i], polygon[(i + 1) % polygon.size()], polygon[1]);
+                }
+
+                continue;
             }
 
-            
-            // Boundary triangles.
-            e1 = mesh.AddEdge(v_old1, v_new1);
-            e2 = mesh.AddEdge(v_old1, v_new2);
-            e3 = mesh.AddEdge(v_new1, v_new2);
-            mesh.AddFace(e1, e2, e3);
-            
-            
-            e1 = mesh.AddEdge(v_old3, v_new1);
-            e2 = mesh.AddEdge(v_old3, v_new2);
-            e3 = mesh.AddEdge(v_new1, v_new2);
-            mesh.AddFace(e1, e2, e3);
-            
-            // Constant edge triangle.
-            e1 = mesh.AddEdge(v_old2, v_new2);
-            e2 = mesh.AddEdge(v_old3, v_new2);
-            e3 = mesh.AddEdge(v_old3, v_old2);
-            mesh.AddFace(e1, e2, e3);
-            
+            stitchPolygon(mesh, polygon, refined == 2 ? split : polygon.size()/2);
         }
-       
-        return mesh;
+
+        mesh.BuildTopology(scratch);
     }
-    
-    
-    // -- Internal subdivision work function.
-    
-    WingedEdge WingedEdge::Subdivide(bool linear, bool pascal)
+
+    // Faces and edges per chunk of the parallel loops.
+    static const int FACE_GRAIN = 1024;
+    static const int EDGE_GRAIN = 1024;
+
+    void WingedEdge::AdaptiveSubdivide(float tolerance, float max_len, int max_faces, WingedEdge &mesh, SubdivisionScratch &scratch,
+                                       Derivations *derivations, ThreadPool *pool)
     {
-        WingedEdge mesh;
-        std::set<Edge> edges;
-        
-        for (auto face = faceList.begin(); face != faceList.end(); ++face)
+        GFX_PROFILE_SCOPE("adaptive_subdivide");
+
+        mesh.Clear();
+        mesh.vertices.assign(vertices.begin(), vertices.end());
+
+        std::vector<int> &split = scratch.split;
+        AdaptiveEdges(tolerance, max_len, max_faces, split, pool);
+
+        SubdivideEdges(split, false, mesh, scratch, derivations, pool);
+        const std::vector<int> &midpoints = scratch.midpoints;
+
+        // -- After the closure every face has 0, 1 or 3 split edges.
+        int num_faces = NumFaces();
+        for(int face = 0; face < num_faces; face++)
         {
-            
-            /* massive assumption that there is 3 edges in our face */
-            Edge e1 = face -> first.E1();
-            Edge e2 = face -> first.E2();
-            Edge e3 = face -> first.E3();
-            
-            /* might need to verify this doesn't pick duplicates */
-            Vertex v1 = e1.V1();
-            Vertex v2 = e1.V2();
-            Vertex v3 = (e2.V1() == v1 || e2.V1() == v2) ? e2.V2() : e2.V1();
-            
-            /* guarantee we know what e2 is */
-            if (v1 == e3.V1() || v1 == e3.V2())
+            int first = 3*face;
+
+            int v[3];
+            int mid[3];
+            int split_count = 0;
+
+            for(int i = 0; i < 3; i++)
             {
-                Edge tmp = e3;
-                e3 = e2;
-                e2 = tmp;
+                v[i]   = halfEdges[first + i].vertex;
+                mid[i] = midpoints[halfEdges[first + i].edge];
+
+                if(mid[i] != -1)
+                {
+                    split_count++;
+                }
             }
-            
-            int f1, f2, f3;
-            f1 = getNumAdjacentFaces(e1);
-            f2 = getNumAdjacentFaces(e2);
-            f3 = getNumAdjacentFaces(e3);
-            
-            // Do not subdivide and do not incorporate non boundary faces.
-            // This is the part the creates the pascal behavior,
-            if(pascal && f1 == 2 && f2 == 2 && f3 == 2)
+
+            if(split_count == 0)
             {
+                mesh.AddFace(v[0], v[1], v[2]);
                 continue;
             }
-            
-            bool success = true;
-            Vertex v4 = SubdivideEdge(face->first, e1, GetAdjacentVertex(face->first, e1, success), linear);
-            Vertex v5 = SubdivideEdge(face->first, e2, GetAdjacentVertex(face->first, e2, success), linear);
-            Vertex v6 = SubdivideEdge(face->first, e3, GetAdjacentVertex(face->first, e3, success), linear);
-            
-            // A half hearted success check.
-            if(!success)
+
+            if(split_count == 3)
             {
-                throw RuntimeError("WindgedEdge Error: Something is wrong with the mesh to be subdivided.");
+                performTriangulation(mesh,
+                                     v[0], v[1], v[2],
+                                     mid[0], mid[1], mid[2]);
+                continue;
+            }
+
+            // Green split from the opposite corner to the new vertex.
+            int i = mid[0] != -1 ? 0 : (mid[1] != -1 ? 1 : 2);
+            int j = (i + 1) % 3;
+            int k = (i + 2) % 3;
+
+            mesh.AddFace(v[i], mid[i], v[k]);
+            mesh.AddFace(mid[i], v[j], v[k]);
+        }
+
+        mesh.BuildTopology(scratch);
+    }
+
+    void WingedEdge::AdaptiveEdges(float tolerance, float max_len, int max_faces, std::vector<int> &split, ThreadPool *pool) const
+    {
+        GFX_PROFILE_SCOPE("adaptive_edges");
+
+        int num_edges = NumEdges();
+        int num_faces = NumFaces();
+
+        float sqr_tolerance = tolerance > 0 ? tolerance*tolerance : -1;
+        float sqr_max_len   = max_len > 0 ? max_len*max_len : -1;
+
+        // -- The squared deviation of the butterfly midpoint of every edge, -1 for edges that are fine as they are.
+        std::vector<float> deviation(num_edges);
+
+        ParallelFor(pool, 0, num_edges, EDGE_GRAIN, [&](int begin, int end)
+        {
+            Stencil stencil;
+
+            for(int e = begin; e < end; e++)
+            {
+                int h = edgeHalfEdge[e];
+
+                EdgeStencil(h, false, stencil);
+                Vertex mid_b = EvaluateStencil(stencil);
+
+                EdgeStencil(h, true, stencil);
+                Vertex mid_l = EvaluateStencil(stencil);
+
+                float offset = computeSqrOffset(mid_b, mid_l);
+                bool  long_edge = sqr_max_len > 0 &&
+                                  computeSqrOffset(vertices[halfEdges[h].vertex], vertices[halfEdges[Next(h)].vertex]) > sqr_max_len;
+
+                deviation[e] = offset > sqr_tolerance || long_edge ? offset : -1;
+            }
+        });
+
+        std::vector<int> candidates;
+        for(int e = 0; e < num_edges; e++)
+        {
+            if(deviation[e] >= 0)
+            {
+                candidates.push_back(e);
             }
-            
+        }
+
+        // The largest deviations are refined first if the budget runs out.
+        std::stable_sort(candidates.begin(), candidates.end(), [&](int a, int b)
+        {
+            return deviation[a] > deviation[b];
+        });
+
+        // -- The faces of every edge, every face half edge is on exactly one edge.
+        std::vector<int> offsets(num_edges + 1, 0);
+        for(size_t h = 0; h < halfEdges.size(); h++)
+        {
+            offsets[halfEdges[h].edge + 1]++;
+        }
+
+        for(int e = 0; e < num_edges; e++)
+        {
+            offsets[e + 1] += offsets[e];
+        }
+
+        std::vector<int> edge_faces(halfEdges.size());
+        std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+        for(size_t h = 0; h < halfEdges.size(); h++)
+        {
+            edge_faces[fill[halfEdges[h].edge]++] = h/3;
+        }
+
+        // -- Mark the edges along with their closure, and take the marks back if they exceed the budget.
+        // Every split edge adds one face to each of its faces.
+        split.assign(num_edges, -1);
+
+        std::vector<int> face_splits(num_faces, 0);
+        std::vector<int> marked;
+        int total_faces = num_faces;
+
+        for(size_t c = 0; c < candidates.size(); c++)
+        {
+            if(split[candidates[c]] != -1)
             {
-                e1 = mesh.AddEdge(v1, v4);
-                e2 = mesh.AddEdge(v1, v5);
-                e3 = mesh.AddEdge(v5, v4);
-                mesh.AddFace(e1, e2, e3);
+                continue;
             }
-            
+
+            marked.assign(1, candidates[c]);
+            split[candidates[c]] = edgeHalfEdge[candidates[c]];
+
+            for(size_t m = 0; m < marked.size(); m++)
             {
-                e1 = mesh.AddEdge(v4, v2);
-                e2 = mesh.AddEdge(v4, v6);
-                e3 = mesh.AddEdge(v6, v2);
-                mesh.AddFace(e1, e2, e3);
+                int e = marked[m];
+                total_faces += offsets[e + 1] - offsets[e];
+
+                for(int k = offsets[e]; k < offsets[e + 1]; k++)
+                {
+                    int face = edge_faces[k];
+
+                    if(++face_splits[face] != 2)
+                    {
+                        continue;
+                    }
+
+                    // Close the face by splitting its third edge.
+                    for(int h = 3*face; h < 3*face + 3; h++)
+                    {
+                        int third = halfEdges[h].edge;
+
+                        if(split[third] == -1)
+                        {
+                            split[third] = edgeHalfEdge[third];
+                            marked.push_back(third);
+                        }
+                    }
+                }
             }
-            
+
+            if(max_faces < 0 || total_faces <= max_faces)
             {
-                e1 = mesh.AddEdge(v5, v6);
-                e2 = mesh.AddEdge(v5, v3);
-                e3 = mesh.AddEdge(v3, v6);
-                mesh.AddFace(e1, e2, e3);
+                continue;
             }
-            
+
+            for(size_t m = 0; m < marked.size(); m++)
             {
-                e1 = mesh.AddEdge(v6, v5);
-                e2 = mesh.AddEdge(v6, v4);
-                e3 = mesh.AddEdge(v4, v5);
-                mesh.AddFace(e1, e2, e3);
+                int e = marked[m];
+                split[e] = -1;
+                total_faces -= offsets[e + 1] - offsets[e];
+
+                for(int k = offsets[e]; k < offsets[e + 1]; k++)
+                {
+                    face_splits[edge_faces[k]]--;
+                }
             }
-            
         }
-        
-        /*
-         std::cout << "Subdivide info: " << std::endl;
-         std::cout << "VertexList: " << mesh.NumVertices() << std::endl;
-         std::cout << "EdgeList: " << mesh.NumEdges() << std::endl;
-         std::cout << "FaceList: " << mesh.NumFaces() << std::endl;
-         */
-        
-        return mesh;
     }
-    
-    // Adds 4 sub triangles based on three original vertices and 3 new vertices to the given mesh.
-    // FIXME : Add better documentation and understanding to this function.
-    void WingedEdge::performTriangulation(WingedEdge &mesh,
-                                          Vertex &v1, Vertex &v2, Vertex &v3,
-                                          Vertex &v4, Vertex &v5, Vertex &v6)
+
+    bool WingedEdge::IsPascalInterior(int face) const
     {
-        Edge e1, e2, e3;
-        
-        
-        // Face 1.
-        e1 = mesh.AddEdge(v1, v5);
-        e2 = mesh.AddEdge(v1, v6);
-        e3 = mesh.AddEdge(v5, v6);
-        mesh.AddFace(e1, e2, e3);
-        
-        
-        // Face 2.
-        e1 = mesh.AddEdge(v2, v4);
-        e2 = mesh.AddEdge(v2, v6);
-        e3 = mesh.AddEdge(v4, v6);
-        mesh.AddFace(e1, e2, e3);
-        //
-        
-        // Face 3.
-        e1 = mesh.AddEdge(v3, v4);
-        e2 = mesh.AddEdge(v3, v5);
-        e3 = mesh.AddEdge(v4, v5);
-        mesh.AddFace(e1, e2, e3);
-        
-        
-        // Face 4.
-        e1 = mesh.AddEdge(v4, v5);
-        e2 = mesh.AddEdge(v4, v6);
-        e3 = mesh.AddEdge(v5, v6);
-        mesh.AddFace(e1, e2, e3);
-        
+        int first = 3*face;
+
+        return edgeFaces[halfEdges[first + 0].edge] == 2 &&
+               edgeFaces[halfEdges[first + 1].edge] == 2 &&
+               edgeFaces[halfEdges[first + 2].edge] == 2;
     }
-    
-    /* This functions computes the new butterfly vertices based on the points in the stencil of the given edge.
-     *FIXME : http://mrl.nyu.edu/~dzorin/papers/zorin1996ism.pdf Page 3.
-     * The special internal cases still need to be implemented.
-     *
-     * Only the degree 6 vertice cases and boundary cases have been implemented for butterfly.
-     *
-     * FIXME : add a type variable to determine what type of interpolation should be used for the edges.
-     *         Currently it always uses the butterfly scheme.
-     *
-     * REQUIRES : e is in f1. b1 is in f1. b1 is not in e.
-     *
+
+    /* The midpoints are computed once per edge by SubdivideEdges(),
+     * then every face writes its sub triangles in parallel to the half edges after those of the faces before it,
+     * so the result does not depend on the number of threads.
      */
-    Vertex WingedEdge::SubdivideEdge(const Face& f1, Edge& e, Vertex b1, bool linear)
+    void WingedEdge::Subdivide(bool linear, bool pascal, WingedEdge &mesh, SubdivisionScratch &scratch,
+                               Derivations *derivations, ThreadPool *pool)
     {
-        /* get our a midpoint */
-        Vertex v;
-        v = e.V1() / 2.0;
-        v = v + (e.V2() / 2.0);
-        
-        if(linear)
+        GFX_PROFILE_SCOPE(pascal ? "pascal_subdivide" : linear ? "linear_subdivide" : "butterfly_subdivide");
+
+        mesh.Clear();
+        mesh.vertices.assign(vertices.begin(), vertices.end());
+
+        int num_faces = NumFaces();
+
+        // -- Every edge of a subdivided face is split, with the stencil seen from the first such face.
+        // Do not subdivide and do not incorporate non boundary faces.
+        // This is the part the creates the pascal behavior,
+        std::vector<int> &split = scratch.split;
+        split.assign(edgeHalfEdge.begin(), edgeHalfEdge.end());
+
+        if(pascal)
         {
-            return v;
+            split.assign(NumEdges(), -1);
         }
-        
-        // Flag for whether we are in theboundary case or not.
-        bool boundary = false;
-        
-        do
+
+        for(int face = 0; pascal && face < num_faces; face++)
         {
-            
-            bool success = true;
-            
-            Face f2 = GetAdjacentFace(f1, e, success);
-            
-            if(!success)
+            if(IsPascalInterior(face))
             {
-                boundary = true;
-                break;
+                continue;
             }
-            
-            /* get our opposing face's b point */
-            Vertex b2 = GetAdjacentVertex(f2, e, success);
-            
-            if(!success)
+
+            for(int h = 3*face; h < 3*face + 3; h++)
             {
-                boundary = true;
-                break;
+                int &half = split[halfEdges[h].edge];
+                if(half == -1)
+                {
+                    half = h;
+                }
+            }
+        }
+
+        SubdivideEdges(split, linear, mesh, scratch, derivations, pool);
+        const std::vector<int> &midpoints = scratch.midpoints;
+
+        {
+            GFX_PROFILE_SCOPE("split_faces");
+
+            // -- The first sub triangle of every face. Only the pascal subdivision leaves faces out.
+            std::vector<int> &first_child = scratch.faces;
+            first_child.resize(num_faces + 1);
+            first_child[0] = 0;
+
+            for(int face = 0; face < num_faces; face++)
+            {
+                first_child[face + 1] = first_child[face] + (pascal && IsPascalInterior(face) ? 0 : 4);
             }
-            
-            v = v + (b1/8.0);
-            v = v + (b2/8.0);
-            
-            /* time to get our c points */
-            std::set<Edge> edges;
-            edges.insert(f1.E1());
-            edges.insert(f1.E2());
-            edges.insert(f1.E3());
-            for (auto edge = edges.begin(); edge != edges.end(); ++edge)
+
+            // -- Split the faces. The corners of a face are distinct and so are the midpoints of its edges,
+            //    so none of the sub triangles are degenerate.
+            HalfEdge half;
+            half.twin = -1;
+            half.edge = -1;
+
+            mesh.halfEdges.assign(3*first_child[num_faces], half);
+
+            ParallelFor(pool, 0, num_faces, FACE_GRAIN, [&](int begin, int end)
             {
-                if (*edge != e)
+                for(int face = begin; face < end; face++)
                 {
-                    v = v - (GetAdjacentFaceVertex(f1, *edge, success)/16.0);
-                    
-                    if(!success)
+                    if(first_child[face] == first_child[face + 1])
+                    {
+                        continue;
+                    }
+
+                    int first = 3*face;
+
+                    int v1 = halfEdges[first + 0].vertex;
+                    int v2 = halfEdges[first + 1].vertex;
+                    int v3 = halfEdges[first + 2].vertex;
+
+                    int v4 = midpoints[halfEdges[first + 0].edge];
+                    int v5 = midpoints[halfEdges[first + 1].edge];
+                    int v6 = midpoints[halfEdges[first + 2].edge];
+
+                    // The same sub triangles as performTriangulation().
+                    int children[12] = {v1, v4, v6,
+                                        v4, v2, v5,
+                                        v6, v5, v3,
+                                        v4, v5, v6};
+
+                    int out = 3*first_child[face];
+
+                    for(int k = 0; k < 12; k++)
                     {
-                        boundary = true;
-                        break;
+                        HalfEdge &child = mesh.halfEdges[out + k];
+                        child.vertex = children[k];
+                        child.next   = out + (k/3)*3 + (k + 1)%3;
                     }
                 }
+            });
+        }
+
+        mesh.BuildTopology(scratch);
+    }
+
+    /* The split edges are numbered in edge order, then their stencils are computed and evaluated in parallel,
+     * once per edge, straight into the new vertices of mesh.
+     * The edges are taken in fixed blocks, each with its own stencil and buffers in the scratch.
+     */
+    void WingedEdge::SubdivideEdges(const std::vector<int> &split, bool linear, WingedEdge &mesh,
+                                    SubdivisionScratch &scratch, Derivations *derivations, ThreadPool *pool) const
+    {
+        GFX_PROFILE_SCOPE("edge_stencils");
+
+        int num_edges  = NumEdges();
+        int num_blocks = (num_edges + EDGE_GRAIN - 1)/EDGE_GRAIN;
+        int first      = mesh.NumVertices();
+
+        std::vector<int> &midpoints = scratch.midpoints;
+        midpoints.assign(num_edges, -1);
+
+        int index = first;
+        for(int e = 0; e < num_edges; e++)
+        {
+            if(split[e] != -1)
+            {
+                midpoints[e] = index++;
             }
-            
-            edges.erase(edges.begin(), edges.end());
-            edges.insert(f2.E1());
-            edges.insert(f2.E2());
-            edges.insert(f2.E3());
-            for (auto edge = edges.begin(); edge != edges.end(); ++edge)
+        }
+
+        mesh.vertices.resize(index);
+
+        if((int)scratch.blocks.size() < num_blocks)
+        {
+            scratch.blocks.resize(num_blocks);
+        }
+
+        ParallelFor(pool, 0, num_blocks, 1, [&](int begin, int end)
+        {
+            for(int b = begin; b < end; b++)
             {
-                if (*edge != e)
+                SubdivisionScratch::Block &block = scratch.blocks[b];
+                block.sizes.clear();
+                block.sources.clear();
+                block.weights.clear();
+
+                int last_edge = std::min(num_edges, (b + 1)*EDGE_GRAIN);
+
+                for(int e = b*EDGE_GRAIN; e < last_edge; e++)
                 {
-                    v = v - (GetAdjacentFaceVertex(f2, *edge, success)/16.0);
-                    if(!success)
+                    if(midpoints[e] == -1)
                     {
-                        boundary = true;
-                        break;
+                        continue;
+                    }
+
+                    EdgeStencil(split[e], linear, block.stencil);
+                    mesh.vertices[midpoints[e]] = EvaluateStencil(block.stencil);
+
+                    // The stencils are only kept if they are recorded.
+                    if(derivations != NULL)
+                    {
+                        const Stencil &stencil = block.stencil;
+                        block.sizes.push_back(stencil.Size());
+                        block.sources.insert(block.sources.end(), stencil.sources.begin(), stencil.sources.end());
+                        block.weights.insert(block.weights.end(), stencil.weights.begin(), stencil.weights.end());
                     }
                 }
             }
-            
-        }
-        while(false);
-        
-        
-        if(boundary)
-        {
-            /*
-             * Proceed with boundary case.
-             */
-            
-            // Extract the 4 vertices.
-            Vertex v1, v2, v3, v4;
-            v1 = e.V1();
-            v2 = e.V2();
-            v3 = getOtherBoundaryVertice(v1, e);
-            v4 = getOtherBoundaryVertice(v2, e);
-            
-            return (v1*9 + v2*9 - v3 - v4)/16.0;
-        }
-        
-        return v;
-    }
-    
-    
-    // --  Windged Edge Mesh topology navigation and transversal helper functions.
-    
-    
-    Vertex WingedEdge::GetAdjacentFaceVertex(const Face& face, const Edge& edge, bool &success)
-    {
-        success = true;
-        Face f2 = GetAdjacentFace(face, edge, success);
-        
-        // Bogus return with false success flag.
-        if(!success)
+        });
+
+        if(derivations == NULL)
         {
-            return edge.V1();
+            return;
         }
-        
-        return GetAdjacentVertex(f2, edge, success);
-    }
-    
-    // Returns. the vertice on the face that is not in the given edge.
-    // FIXME : Do we really need to check successes? This should be guranteed.
-    Vertex WingedEdge::GetAdjacentVertex(const Face& face, const Edge& edge, bool &success)
-    {
-        success = true;
-        
-        if (face.E1() != edge)
-            return (face.E1().V1() == edge.V1()) ? face.E1().V2() : face.E1().V1();
-        
-        else if (face.E2() != edge)
-            return (face.E2().V1() == edge.V1()) ? face.E2().V2() : face.E2().V1();
-        
-        else if (face.E3() != edge)
-            return (face.E3().V1() == edge.V1()) ? face.E3().V2() : face.E3().V1();
-        
-        // Bugus return.
-        success = false;
-        return edge.V1();
-        //throw RuntimeError("Couldn't find Adjacent Vertex");
-    }
-    
-    Face WingedEdge::GetAdjacentFace(const Face& face, const Edge& edge, bool &success)
-    {
-        success = true;
-        
-        EdgeList edgeList = edgeListMap[edge];
-        std::set<Face>::const_iterator it;
-        for (it = edgeList.faces.begin(); it != edgeList.faces.end(); ++it)
+
+        // -- Record the stencils in edge order.
+        for(int b = 0; b < num_blocks; b++)
         {
-            if (*it != face)
-                return *it;
+            const SubdivisionScratch::Block &block = scratch.blocks[b];
+            int tap = 0;
+
+            for(size_t i = 0; i < block.sizes.size(); i++)
+            {
+                int size = block.sizes[i];
+
+                Stencil &derivation = AddDerivation(*derivations, first++);
+                derivation.sources.assign(block.sources.begin() + tap, block.sources.begin() + tap + size);
+                derivation.weights.assign(block.weights.begin() + tap, block.weights.begin() + tap + size);
+                tap += size;
+            }
         }
-        
-        // Bogus return on non success.
-        success = false;
-        return face;
-        // throw RuntimeError("Couldn't find adjacent face.");
-    }
-    
-    int WingedEdge::getNumAdjacentFaces(const Edge& edge)
-    {
-        EdgeList edgeList = edgeListMap[edge];
-        
-        return edgeList.faces.size();
     }
-    
-    Vertex WingedEdge::getOtherVertex(Edge &edge, Vertex &v)
+
+    // Adds 4 sub triangles to the given mesh.
+    // v1, v2, v3 are the corners of the original face in order,
+    // v4, v5, v6 are the midpoints of the edges v1-v2, v2-v3 and v3-v1.
+    // The sub triangles keep the orientation of the original face.
+    void WingedEdge::performTriangulation(WingedEdge &mesh,
+                                          int v1, int v2, int v3,
+                                          int v4, int v5, int v6)
     {
-        Vertex v1 = edge.V1();
-        return v1 == v ? edge.V2() : v1;
-        
+        // Corner faces.
+        mesh.AddFace(v1, v4, v6);
+        mesh.AddFace(v4, v2, v5);
+        mesh.AddFace(v6, v5, v3);
+
+        // Center face.
+        mesh.AddFace(v4, v5, v6);
     }
-    
-    // Returns the boundary edge that is not e.
-    Vertex WingedEdge::getOtherBoundaryVertice(Vertex &a, Edge &forbidden_edge)
+
+    // Adds the k point stencil of an extraordinary interior vertex, scaled by the given factor.
+    static void addValenceStencil(int center, const int *ring, int valence, float scale, Stencil &stencil)
     {
-        std::set<Edge> edges = vertexList[a];
-        for(Edge e : edges)
+        const float *weights = ValenceWeights(valence);
+
+        stencil.Add(center, 3/4.0f*scale);
+
+        for(int j = 0; j < valence; j++)
         {
-            if(e != forbidden_edge && getNumAdjacentFaces(e) == 1)
+            if(weights[j] != 0)
             {
-                return getOtherVertex(e, a);
+                stencil.Add(ring[j], weights[j]*scale);
             }
         }
-        
-        //throw RuntimeError("No other boundary edge was found. Something might be wrong with your mesh.");
-        return a;
-    }
-    
-    
-    // Returns the squared euclidean distance between the two vertices.
-    float WingedEdge::computeSqrOffset(Vertex v1,Vertex v2)
-    {
-     
-        Vertex v = v1 - v2;
-        return v.X()*v.X() + v.Y()*v.Y() + v.Z() * v.Z();
     }
- 
-    
-    
-    
-    
-    
-    
-    
-    
-    
-    
-    /*
-     *
-     *
-     *  Special point derivation Subdivision routines.
-     *
+
+    /* This functions computes the stencil of the new butterfly vertex for the edge of the given half edge,
+     * following the modified butterfly rules : http://mrl.nyu.edu/~dzorin/papers/zorin1996ism.pdf Page 3.
      *
+     * Boundary edges use the 4 point rule.
+     * If an end point is an interior vertex of valence other than 6, the k point stencil around it is used,
+     * and the two k point stencils are averaged if both end points are.
+     * Otherwise the regular 8 point butterfly is used. Wings that are missing next to the boundary
+     * are replaced by the ghost vertex that completes the parallelogram across the boundary edge.
+     * The ghost wings are not the boundary rules of Zorin's thesis, but they keep new vertices on their edge midpoints
+     * wherever the mesh is a flat regular grid, see tests/flat_grid.cpp.
      */
-    
-    
-    
-    
-     
-    // Subdivides all edges on the boundary. Populates information about the vertices that were subdivided.
-    WingedEdge WingedEdge::BoundaryTrianglularSubdivide(std::map<Vertex, std::vector<Vertex> > &derivations)
+    void WingedEdge::EdgeStencil(int h, bool linear, Stencil &stencil) const
     {
-        
-        WingedEdge mesh;
-        
-        
-        for (auto face_iter = faceList.begin(); face_iter != faceList.end(); ++face_iter)
+        stencil.Clear();
+
+        // Find 'a' points.
+        int a1 = halfEdges[h].vertex;
+        int a2 = halfEdges[Next(h)].vertex;
+
+        if(linear)
         {
-            const Face face = face_iter -> first;
-            
-            
-            /* massive assumption that there is 3 edges in our face */
-            Edge e1 = face.E1();
-            Edge e2 = face.E2();
-            Edge e3 = face.E3();
-            
-            // Compute the vertices opposite the cooresponding indiced edges.
-            bool success = true;
-            Vertex v1 = GetAdjacentVertex(face, e1, success);
-            Vertex v2 = GetAdjacentVertex(face, e2, success);
-            Vertex v3 = GetAdjacentVertex(face, e3, success);
-            
-            if(!success)
-            {
-                throw new RuntimeError("Error : Winged Edge topology is malformed!");
-            }
-            
-            // -- Compute boundary predicates that answer whether or not an edge should be divided.
-            bool b1, b2, b3;
-            b1 = getNumAdjacentFaces(e1) == 1;
-            b2 = getNumAdjacentFaces(e2) == 1;
-            b3 = getNumAdjacentFaces(e3) == 1;
-            
-            // Non Boundary --> do not subdivide the face.
-            if(!(b1 || b2 || b3))
-            {
-                
-                e1 = mesh.AddEdge(e1);
-                e2 = mesh.AddEdge(e2);
-                e2 = mesh.AddEdge(e2);
-                
-                mesh.AddFace(e1, e2, e3);
-                
-                continue;
-            }
-            
-            
-            // FIXME : Only compute butterfly midpoints, if the original predicate is true.
-            
-            // Compute interpolated midpoints.
-            Vertex mid_b1, mid_b2, mid_b3;
-            
-            if(b1){mid_b1 = SubdivideBoundaryEdge(e1, derivations);}
-            if(b2){mid_b2 = SubdivideBoundaryEdge(e2, derivations);}
-            if(b3){mid_b3 = SubdivideBoundaryEdge(e3, derivations);}
-            
-            // -- Count the number of edges that are on the boundary.
-            int boundary_count = 0;
-            boundary_count = b1 ? boundary_count + 1 : boundary_count;
-            boundary_count = b2 ? boundary_count + 1 : boundary_count;
-            boundary_count = b3 ? boundary_count + 1 : boundary_count;
-            
-            // Non Boundary --> do not subdivide the face.
-            if(boundary_count == 0)
+            stencil.Add(a1, 1/2.0f);
+            stencil.Add(a2, 1/2.0f);
+            return;
+        }
+
+        int t = halfEdges[h].twin;
+
+        if(t == -1)
+        {
+            BoundaryStencil(h, stencil);
+            return;
+        }
+
+        // -- Extraordinary interior vertices, the weights are looked up by valence.
+        int ring1[MAX_VALENCE + 1];
+        int ring2[MAX_VALENCE + 1];
+
+        int k1 = VertexRing(h, ring1);
+        int k2 = VertexRing(t, ring2);
+
+        bool extraordinary1 = k1 != 6 && ValenceWeights(k1) != NULL;
+        bool extraordinary2 = k2 != 6 && ValenceWeights(k2) != NULL;
+
+        if(extraordinary1 || extraordinary2)
+        {
+            float scale = extraordinary1 && extraordinary2 ? 1/2.0f : 1.0f;
+
+            if(extraordinary1)
             {
-                e1 = mesh.AddEdge(e1);
-                e2 = mesh.AddEdge(e2);
-                e2 = mesh.AddEdge(e2);
-                
-                mesh.AddFace(e1, e2, e3);
-                continue;
+                addValenceStencil(a1, ring1, k1, scale, stencil);
             }
-            
-            
-            // 1 boundary --> subdivide into 2 vertices.
-            if(boundary_count == 1)
+
+            if(extraordinary2)
             {
-                
-                Vertex v_new, v_old1, v_old2, v_old3;
-                
-                if(b1)
-                {
-                    v_new = mid_b1;
-                    v_old1 = v1;
-                    v_old2 = v2;
-                    v_old3 = v3;
-                }
-                else if(b2)
-                {
-                    v_new = mid_b2;
-                    v_old1 = v2;
-                    v_old2 = v3;
-                    v_old3 = v1;
-                }
-                else
-                {
-                    v_new = mid_b3;
-                    v_old1 = v3;
-                    v_old2 = v1;
-                    v_old3 = v2;
-                }
-                
-                // face1
-                e1 = mesh.AddEdge(v_new, v_old1);
-                e2 = mesh.AddEdge(v_new, v_old2);
-                e3 = mesh.AddEdge(v_old1, v_old2);
-                mesh.AddFace(e1, e2, e3);
-                
-                // Face 2.
-                e2 = mesh.AddEdge(v_new, v_old3);
-                e3 = mesh.AddEdge(v_old1, v_old3);
-                mesh.AddFace(e1, e2, e3);
-                
-                continue;
+                addValenceStencil(a2, ring2, k2, scale, stencil);
             }
-            
-            // 2 - 3 boundaries. Perform the full 4 face triangulation.
-            
-            if(boundary_count == 3)
+
+            return;
+        }
+
+        // -- The regular butterfly.
+        stencil.Add(a1, 8/16.0f);
+        stencil.Add(a2, 8/16.0f);
+
+        // Find 'b' points.
+        stencil.Add(OppositeVertex(h), 2/16.0f);
+        stencil.Add(OppositeVertex(t), 2/16.0f);
+
+        // Find 'c' points, these are opposite to the other edges of the two faces.
+        int wings[4] = {Next(h), Prev(h), Next(t), Prev(t)};
+
+        for(int i = 0; i < 4; i++)
+        {
+            int c = halfEdges[wings[i]].twin;
+
+            if(c != -1)
             {
-                performTriangulation(mesh,
-                                     v1, v2, v3,
-                                     mid_b1, mid_b2, mid_b3);
-                
+                stencil.Add(OppositeVertex(c), -1/16.0f);
                 continue;
             }
-            
-            if(boundary_count > 3)
-            {
-                throw new RuntimeError("Face has more than 3 edges. This is not a triangle!");
-            }
-            
-            // -- 2 boundary case. Subdivide into 3 triangles.
-            Vertex v_new1, v_new2, v_old1, v_old2, v_old3;
-            
-            if(!b1)
-            {
-                v_old1 = v1;
-                v_old2 = v2;
-                v_old3 = v3;
-                v_new1 = mid_b2;
-                v_new2 = mid_b3;
-            }
-            else if(!b2)
-            {
-                v_old1 = v2;
-                v_old2 = v3;
-                v_old3 = v1;
-                v_new1 = mid_b3;
-                v_new2 = mid_b1;
-            }
-            else
-            {
-                v_old1 = v3;
-                v_old2 = v1;
-                v_old3 = v2;
-                v_new1 = mid_b1;
-                v_new2 = mid_b2;
-            }
-            
-            
-            // Boundary triangles.
-            e1 = mesh.AddEdge(v_old1, v_new1);
-            e2 = mesh.AddEdge(v_old1, v_new2);
-            e3 = mesh.AddEdge(v_new1, v_new2);
-            mesh.AddFace(e1, e2, e3);
-            
-            
-            e1 = mesh.AddEdge(v_old3, v_new1);
-            e2 = mesh.AddEdge(v_old3, v_new2);
-            e3 = mesh.AddEdge(v_new1, v_new2);
-            mesh.AddFace(e1, e2, e3);
-            
-            // Constant edge triangle.
-            e1 = mesh.AddEdge(v_old2, v_new2);
-            e2 = mesh.AddEdge(v_old3, v_new2);
-            e3 = mesh.AddEdge(v_old3, v_old2);
-            mesh.AddFace(e1, e2, e3);
-            
+
+            // Boundary wing, the ghost vertex x + y - z mirrors the opposite corner z across the edge x y.
+            int x = halfEdges[wings[i]].vertex;
+            int y = halfEdges[Next(wings[i])].vertex;
+            int z = OppositeVertex(wings[i]);
+
+            stencil.Add(x, -1/16.0f);
+            stencil.Add(y, -1/16.0f);
+            stencil.Add(z,  1/16.0f);
         }
-        
-        return mesh;
     }
 
-    
-    
-    // Computes interpolated vertices.
-    Vertex WingedEdge::SubdivideBoundaryEdge(Edge& e, std::map<Vertex, std::vector<Vertex> > &derivations)
+    // The 4 point boundary rule, uses the neighbours of the edge end points along the boundary.
+    void WingedEdge::BoundaryStencil(int h, Stencil &stencil) const
     {
-        /*
-         * Proceed with boundary case.
-         */
-        
-        // Extract the 4 vertices.
-        Vertex v1, v2, v3, v4;
-        v1 = e.V1();
-        v2 = e.V2();
-        v3 = getOtherBoundaryVertice(v1, e);
-        v4 = getOtherBoundaryVertice(v2, e);
-        
-        Vertex result = (v1*9 + v2*9 - v3 - v4)/16.0;
-        
-        // Store the derivation data.
-        std::vector<Vertex> v;
-        v.push_back(v1);
-        v.push_back(v2);
-        v.push_back(v3);
-        v.push_back(v4);
-        
-        derivations[result] = v;
-        
-        return result;
+        int v1 = halfEdges[h].vertex;
+        int v2 = halfEdges[Next(h)].vertex;
+
+        // Follow the boundary through the fans of faces around the end points,
+        // this keeps to the right boundary where several boundaries touch at a vertex.
+        int v3 = PreviousBoundaryVertex(h);
+        int v4 = NextBoundaryVertex(h);
+
+        stencil.Clear();
+        stencil.Add(v1, 9/16.0f);
+        stencil.Add(v2, 9/16.0f);
+        stencil.Add(v3 != -1 ? v3 : getOtherBoundaryVertice(v1, v2), -1/16.0f);
+        stencil.Add(v4 != -1 ? v4 : getOtherBoundaryVertice(v2, v1), -1/16.0f);
     }
-    
-    
-    // -- Public interface wrapper functions.
-    WingedEdge WingedEdge::ButterflySubdivide(std::map<Vertex, std::vector<Vertex> > &derivations)
+
+    Vertex WingedEdge::EvaluateStencil(const Stencil &stencil) const
     {
-        return Subdivide(false, false, derivations);
+        // Accumulated in the same order as StencilTable::Apply(), so both give identical results.
+        Vertex v(0, 0, 0);
+        for(int k = 0; k < stencil.Size(); k++)
+        {
+            v = v + vertices[stencil.sources[k]]*stencil.weights[k];
+        }
+
+        return v;
     }
-    
-    WingedEdge WingedEdge::LinearSubdivide(std::map<Vertex, std::vector<Vertex> > &derivations)
+
+
+    // --  Half Edge Mesh topology navigation and transversal helper functions.
+
+    int WingedEdge::PreviousBoundaryVertex(int h) const
     {
-        return Subdivide(true, false, derivations);
+        int g = PreviousBoundaryEdge(h);
+        return g == -1 ? -1 : halfEdges[g].vertex;
     }
-    
-    WingedEdge WingedEdge::SillyPascalSubdivide(std::map<Vertex, std::vector<Vertex> > &derivations)
+
+    int WingedEdge::NextBoundaryVertex(int h) const
     {
-        return Subdivide(false, true, derivations);
+        int g = NextBoundaryEdge(h);
+        return g == -1 ? -1 : halfEdges[Next(g)].vertex;
     }
 
-    // Private work function.
-    WingedEdge WingedEdge::Subdivide(bool linear, bool pascal, std::map<Vertex, std::vector<Vertex> > &derivations)
+    // Turns around the origin of h, away from the face of h, until a boundary edge is found.
+    // Returns -1 if the origin is an interior vertex or the faces around it are not consistently oriented.
+    int WingedEdge::PreviousBoundaryEdge(int h) const
     {
-        WingedEdge mesh;
-        std::set<Edge> edges;
-        
-        for (auto face = faceList.begin(); face != faceList.end(); ++face)
+        int a = halfEdges[h].vertex;
+        int g = Prev(h);
+
+        for(int steps = NumFaces(); halfEdges[g].twin != -1; steps--)
         {
-            
-            /* massive assumption that there is 3 edges in our face */
-            Edge e1 = face -> first.E1();
-            Edge e2 = face -> first.E2();
-            Edge e3 = face -> first.E3();
-            
-            /* might need to verify this doesn't pick duplicates */
-            Vertex v1 = e1.V1();
-            Vertex v2 = e1.V2();
-            Vertex v3 = (e2.V1() == v1 || e2.V1() == v2) ? e2.V2() : e2.V1();
-            
-            /* guarantee we know what e2 is */
-            if (v1 == e3.V1() || v1 == e3.V2())
-            {
-                Edge tmp = e3;
-                e3 = e2;
-                e2 = tmp;
-            }
-            
-            int f1, f2, f3;
-            f1 = getNumAdjacentFaces(e1);
-            f2 = getNumAdjacentFaces(e2);
-            f3 = getNumAdjacentFaces(e3);
-            
-            // Do not subdivide and do not incorporate non boundary faces.
-            // This is the part the creates the pascal behavior,
-            if(pascal && f1 == 2 && f2 == 2 && f3 == 2)
-            {
-                continue;
-            }
-            
-            bool success = true;
-            Vertex v4 = SubdivideEdge(face->first, e1, GetAdjacentVertex(face->first, e1, success), linear, derivations);
-            Vertex v5 = SubdivideEdge(face->first, e2, GetAdjacentVertex(face->first, e2, success), linear, derivations);
-            Vertex v6 = SubdivideEdge(face->first, e3, GetAdjacentVertex(face->first, e3, success), linear, derivations);
-            
-            // A half hearted success check.
-            if(!success)
-            {
-                throw RuntimeError("WindgedEdge Error: Something is wrong with the mesh to be subdivided.");
-            }
-            
-            {
-                e1 = mesh.AddEdge(v1, v4);
-                e2 = mesh.AddEdge(v1, v5);
-                e3 = mesh.AddEdge(v5, v4);
-                mesh.AddFace(e1, e2, e3);
-            }
-            
-            {
-                e1 = mesh.AddEdge(v4, v2);
-                e2 = mesh.AddEdge(v4, v6);
-                e3 = mesh.AddEdge(v6, v2);
-                mesh.AddFace(e1, e2, e3);
-            }
-            
-            {
-                e1 = mesh.AddEdge(v5, v6);
-                e2 = mesh.AddEdge(v5, v3);
-                e3 = mesh.AddEdge(v3, v6);
-                mesh.AddFace(e1, e2, e3);
-            }
-            
+            int t = halfEdges[g].twin;
+
+            if(t == h || halfEdges[t].vertex != a || steps == 0)
             {
-                e1 = mesh.AddEdge(v6, v5);
-                e2 = mesh.AddEdge(v6, v4);
-                e3 = mesh.AddEdge(v4, v5);
-                mesh.AddFace(e1, e2, e3);
+                return -1;
             }
-            
+
+            g = Prev(t);
         }
-        
-        /*
-         std::cout << "Subdivide info: " << std::endl;
-         std::cout << "VertexList: " << mesh.NumVertices() << std::endl;
-         std::cout << "EdgeList: " << mesh.NumEdges() << std::endl;
-         std::cout << "FaceList: " << mesh.NumFaces() << std::endl;
-         */
-        
-        return mesh;
+
+        return g;
     }
 
-    
-    /* This functions computes the new butterfly vertices based on the points in the stencil of the given edge.
-     *FIXME : http://mrl.nyu.edu/~dzorin/papers/zorin1996ism.pdf Page 3.
-     * The special internal cases still need to be implemented.
-     *
-     * Only the degree 6 vertice cases and boundary cases have been implemented for butterfly.
-     *
-     * FIXME : add a type variable to determine what type of interpolation should be used for the edges.
-     *         Currently it always uses the butterfly scheme.
-     *
-     * REQUIRES : e is in f1. b1 is in f1. b1 is not in e.
-     *
-     */
-    Vertex WingedEdge::SubdivideEdge(const Face& f1, Edge& e, Vertex b1, bool linear,
-                                     std::map<Vertex, std::vector<Vertex> > &derivations)
+    // Turns around the end of h, away from the face of h, until a boundary edge is found.
+    int WingedEdge::NextBoundaryEdge(int h) const
     {
-        
-        // Initialize the derivation structure.
-        std::vector<Vertex> derive_indices;
-        
-        // Find 'a' points.
-        Vertex a1 = e.V1();
-        Vertex a2 = e.V2();
-        
-        // Add 'a' points to the derivation vector.
-        derive_indices.push_back(a1);
-        derive_indices.push_back(a2);
-        
-        
-        /* get our a midpoint */
-        Vertex v;
-        v = a1 / 2.0;
-        v = v + (a2 / 2.0);
-        
-        
-        if(linear)
-        {
-            derivations[v] = derive_indices;
-            return v;
-        }
-        
-        // Flag for whether we are in theboundary case or not.
-        bool boundary = false;
-        
-        do
+        int b = halfEdges[Next(h)].vertex;
+        int g = Next(h);
+
+        for(int steps = NumFaces(); halfEdges[g].twin != -1; steps--)
         {
-            
-            bool success = true;
-            
-            Face f2 = GetAdjacentFace(f1, e, success);
-            
-            if(!success)
-            {
-                boundary = true;
-                break;
-            }
-            
-            /* get our opposing face's b point */
-            Vertex b2 = GetAdjacentVertex(f2, e, success);
-            
-           
-            if(!success)
+            int t = halfEdges[g].twin;
+
+            if(t == h || halfEdges[Next(t)].vertex != b || steps == 0)
             {
-                boundary = true;
-                break;
+                return -1;
             }
 
-          
-            v = v + (b1/8.0);
-            v = v + (b2/8.0);
-            
-            // Add 'b' points to the derivation vector.
-            derive_indices.push_back(b1);
-            derive_indices.push_back(b2);
-            
-            
-            /* time to get our c points */
-            std::set<Edge> edges;
-            edges.insert(f1.E1());
-            edges.insert(f1.E2());
-            edges.insert(f1.E3());
-            for (auto edge = edges.begin(); edge != edges.end(); ++edge)
+            g = Next(t);
+        }
+
+        return g;
+    }
+
+    // Turns around the origin of h through the twins of the incoming edges, until it is back at h.
+    int WingedEdge::VertexRing(int h, int *ring) const
+    {
+        int a = halfEdges[h].vertex;
+        int g = h;
+
+        for(int valence = 1; valence <= MAX_VALENCE + 1; valence++)
+        {
+            ring[valence - 1] = halfEdges[Next(g)].vertex;
+
+            int t = halfEdges[Prev(g)].twin;
+
+            if(t == -1 || halfEdges[t].vertex != a)
             {
-                if (*edge != e)
-                {
-                    Vertex c = GetAdjacentFaceVertex(f1, *edge, success);
-                    v = v - (c/16.0);
-                    
-                    if(derive_indices.size() < 8)
-                    {
-                        derive_indices.push_back(c);
-                    }
-                    
-                    if(!success)
-                    {
-                        boundary = true;
-                        break;
-                    }
-                }
+                return -1;
             }
-            
-            edges.erase(edges.begin(), edges.end());
-            edges.insert(f2.E1());
-            edges.insert(f2.E2());
-            edges.insert(f2.E3());
-            for (auto edge = edges.begin(); edge != edges.end(); ++edge)
+
+            if(t == h)
             {
-                if (*edge != e)
-                {
-                    Vertex c = GetAdjacentFaceVertex(f2, *edge, success);
-                    
-                    v = v - (c/16.0);
-                    
-                    if(derive_indices.size() < 8)
-                    {
-                        derive_indices.push_back(c);
-                    }
-                    
-                    if(!success)
-                    {
-                        boundary = true;
-                        break;
-                    }
-                }
+                return valence;
             }
-            
+
+            g = t;
+        }
+
+        return MAX_VALENCE + 1;
+    }
+
+    // Returns the boundary vertex adjacent to a that is not b.
+    int WingedEdge::getOtherBoundaryVertice(int a, int b) const
+    {
+        const int *neighbors = &boundaryNeighbors[2*a];
+
+        if(neighbors[0] != -1 && neighbors[0] != b)
+        {
+            return neighbors[0];
         }
-        while(false);
-        
-        
-        if(boundary)
+
+        if(neighbors[1] != -1 && neighbors[1] != b)
         {
-            /*
-             * Proceed with boundary case.
-             */
-            
-            // Extract the 4 vertices.
-            Vertex v1, v2, v3, v4;
-            v1 = e.V1();
-            v2 = e.V2();
-            v3 = getOtherBoundaryVertice(v1, e);
-            v4 = getOtherBoundaryVertice(v2, e);
-            
-            // For the boundary case, we will will ignore the derive_indices vector,
-            // and just compute a new vector with the 4 indices.
-            std::vector<Vertex> boundary_indices;
-            boundary_indices.push_back(v1);
-            boundary_indices.push_back(v2);
-            boundary_indices.push_back(v3);
-            boundary_indices.push_back(v4);
-            
-            Vertex output = (v1*9 + v2*9 - v3 - v4)/16.0;
-            
-            derivations[output] = boundary_indices;
-            
-            return output;
+            return neighbors[1];
         }
-        
-        
-        derivations[v] = derive_indices;
-        
-        return v;
+
+        //throw RuntimeError("No other boundary edge was found. Something might be wrong with your mesh.");
+        return a;
+    }
+
+
+    // Returns the squared euclidean distance between the two vertices.
+    float WingedEdge::computeSqrOffset(Vertex v1,Vertex v2) const
+    {
+
+        Vertex v = v1 - v2;
+        return v.X()*v.X() + v.Y()*v.Y() + v.Z() * v.Z();
     }
 
-    
-    
     /* end */
 }
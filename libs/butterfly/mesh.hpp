@@ -1,123 +1,231 @@
 #ifndef __GFX_MESH_HPP
 #define __GFX_MESH_HPP
 
-#ifdef __APPLE__
-#include <OpenGL/gl.h>
-#else
-#include <GL/gl.h>
-#endif
-
-#include <map>
-#include <set>
 #include <vector>
 #include "vertex.hpp"
-#include "edge.hpp"
-#include "face.hpp"
+#include "stencil.hpp"
+#include "thread_pool.hpp"
 
 namespace gfx
 {
 
-typedef std::map<Face, std::set<Edge> > FaceList;
-
-struct EdgeList
+/* Every face is a triangle, so face f owns the half edges 3f, 3f + 1 and 3f + 2,
+ * and half edge 3f + k starts at the k'th corner of the face. */
+struct HalfEdge
 {
-  std::set<Vertex> vertices;
-  std::set<Face> faces;
-  std::set<Edge> edges;
+    int vertex; // Origin vertex.
+    int twin;   // Opposite half edge in the neighbouring face, -1 on the boundary.
+    int next;   // Next half edge around the face.
+    int edge;   // Undirected edge index.
 };
 
-typedef std::map<Edge, EdgeList> EdgeListMap;
+/* The temporary arrays of a subdivision.
+ * Kept between subdivisions along with the meshes that are subdivided into, they stop allocating
+ * once they have grown to the size of the finest level.
+ */
+struct SubdivisionScratch
+{
+    std::vector<int> split;     // The half edge to split every edge with, or -1.
+    std::vector<int> midpoints; // The midpoint vertex of every edge, or -1.
+    std::vector<int> faces;     // The first sub triangle of every face.
+
+    // The stencil of every block of edges, and the taps of its new vertices packed one after another if they are recorded.
+    struct Block
+    {
+        Stencil stencil;
+
+        std::vector<int>   sizes;
+        std::vector<int>   sources;
+        std::vector<float> weights;
+    };
 
-typedef std::map<Vertex, std::set<Edge> > VertexList;
+    std::vector<Block> blocks;
+
+    // The half edge buckets of BuildTopology().
+    std::vector<int> offsets;
+    std::vector<int> bucket;
+    std::vector<int> fill;
+};
 
-/* based on wikipedia article http://en.wikipedia.org/wiki/Polygon_mesh */
+/* Index based half edge mesh.
+ * Vertices, half edges, edges and faces are stored in flat arrays and refer to each other by index,
+ * so every adjacency query is O(1) and vertex identity no longer depends on float comparisons.
+ *
+ * Subdivision never reorders vertices. The vertices of a mesh are always a prefix of the vertices
+ * of its subdivision, which keeps vertex indices stable across any number of subdivisions.
+ */
 class WingedEdge
 {
 public:
     /* made these public for fromWingedEdge */
-    FaceList faceList;
-    EdgeListMap edgeListMap;
-    VertexList vertexList;
-    
+    std::vector<Vertex>   vertices;
+    std::vector<HalfEdge> halfEdges;
+
+    // Per edge : a half edge on the edge and the number of faces that share it.
+    std::vector<int> edgeHalfEdge;
+    std::vector<int> edgeFaces;
+
+    // Per vertex : the first two boundary edge neighbours, -1 if there are none.
+    std::vector<int> boundaryNeighbors;
+
     WingedEdge(){}
-    
-    Vertex AddVertex(GLfloat x, GLfloat y, GLfloat z);
-    Edge AddEdge(const Vertex& v1, const Vertex& v2);
-    Edge AddEdge(const Edge& e);
-    Face AddFace(const Edge& e1, const Edge& e2, const Edge& e3);
-    
-    int NumVertices() const { return vertexList.size(); }
-    int NumEdges() const { return edgeListMap.size(); }
-    int NumFaces() const { return faceList.size(); }
-    
-    void Draw();
-    
+
+    int AddVertex(float x, float y, float z);
+    int AddVertex(const Vertex& v);
+
+    // Adds the triangle v1, v2, v3. Degenerate triangles are ignored and -1 is returned.
+    // REQUIRES : BuildTopology() is called once all of the faces have been added.
+    int AddFace(int v1, int v2, int v3);
+
+    // Links twins, edges and boundary information for the faces that have been added.
+    void BuildTopology();
+    void BuildTopology(SubdivisionScratch &scratch);
+
+    // Removes everything from the mesh, but keeps the capacity of its arrays.
+    void Clear();
+
+    void swap(WingedEdge &mesh);
+
+    int NumVertices() const { return vertices.size(); }
+    int NumEdges() const { return edgeHalfEdge.size(); }
+    int NumFaces() const { return halfEdges.size() / 3; }
+
+    // The i'th corner of face f.
+    int FaceVertex(int f, int i) const { return halfEdges[3*f + i].vertex; }
+
+    bool IsBoundaryEdge(int e) const { return edgeFaces[e] == 1; }
+
+    // The faces of the linear, butterfly and pascal subdivisions are refined in parallel if a pool is given.
+    // The result does not depend on the pool.
+
     // Linear interpolated subdivision. Triangles in/out.
-    WingedEdge LinearSubdivide();
-   
-    // Butterfly subdivision with naive inner cases and boundary cases.
+    WingedEdge LinearSubdivide(ThreadPool *pool = NULL);
+
+    // Zorin's modified butterfly subdivision with extraordinary vertex and boundary cases.
     // Triangles in/out.
-    WingedEdge ButterflySubdivide();
-    
+    WingedEdge ButterflySubdivide(ThreadPool *pool = NULL);
+
     // Subdivides the boundaries smoothly. Does not subdivide interior triangles.
     // Triangles in/out.
     // if max_len > 0 this will only subdivide edges of length greater than min_len.
     WingedEdge BoundaryTrianglularSubdivide(float min_len = -1);
-    
-    
+
+    /* Butterfly subdivision that only splits the edges where it matters : edges whose butterfly midpoint is further
+     * than tolerance from their linear midpoint, and edges longer than max_len if max_len > 0.
+     * Red green closure keeps the mesh watertight : faces with one split edge are bisected, faces with three are split
+     * into four, and a face with two split edges gets its third edge split as well.
+     * If max_faces >= 0 the edges are taken in order of decreasing deviation while the result has at most max_faces faces.
+     * Triangles in/out.
+     */
+    WingedEdge AdaptiveButterflySubdivide(float tolerance, float max_len = -1, int max_faces = -1, ThreadPool *pool = NULL);
+
+    /* Refines the boundary in one pass until the 4 point midpoint of every boundary edge is within precision
+     * of its linear midpoint, or until the mesh has max_vertices vertices if max_vertices >= 0.
+     * The edge with the largest deviation is split first, and only its neighbours are measured again.
+     * Interior faces are kept, every boundary face is triangulated over its refined edges.
+     * Triangles in/out.
+     */
+    WingedEdge BoundaryRefine(float precision, int max_vertices = -1);
+
     // Subdivides exterior faces, deletes interior vertices.
     // This is not the most serious of subdivision schemes.
-    WingedEdge SillyPascalSubdivide();
-  
-    
-    
-    
+    WingedEdge SillyPascalSubdivide(ThreadPool *pool = NULL);
+
+
+
+
     /*
      * Special Derivation capable routinues.
+     * Every new vertex is recorded in derivations along with the stencil it was interpolated with.
      */
-    WingedEdge BoundaryTrianglularSubdivide(std::map<Vertex, std::vector<Vertex> > &derivations);
-    WingedEdge ButterflySubdivide(std::map<Vertex, std::vector<Vertex> > &derivations);
-    WingedEdge LinearSubdivide(std::map<Vertex, std::vector<Vertex> > &derivations);
-    WingedEdge SillyPascalSubdivide(std::map<Vertex, std::vector<Vertex> > &derivations);
-    
-private:
+    WingedEdge BoundaryTrianglularSubdivide(Derivations &derivations, float min_len = -1);
+    WingedEdge ButterflySubdivide(Derivations &derivations, ThreadPool *pool = NULL);
+    WingedEdge LinearSubdivide(Derivations &derivations, ThreadPool *pool = NULL);
+    WingedEdge SillyPascalSubdivide(Derivations &derivations, ThreadPool *pool = NULL);
+    WingedEdge AdaptiveButterflySubdivide(Derivations &derivations, float tolerance, float max_len = -1, int max_faces = -1,
+                                          ThreadPool *pool = NULL);
+
+    // The new vertices are derived from each other, their derivations are expanded to the old vertices.
+    WingedEdge BoundaryRefine(Derivations &derivations, float precision, int max_vertices = -1);
 
-    // The internal subdivision algorithm that takes options and subdivides based on the user's wishes.
-    WingedEdge Subdivide(bool linear, bool pascal);
-    
-    // Computes interpolated vertices.
-    Vertex SubdivideEdge(const Face& f1, Edge& e, Vertex b1, bool linear);
-    
-    
-    // -- Windged Edge transversal helper functions.
-    
-    Face GetAdjacentFace(const Face& face, const Edge& edge, bool &success);
-    Vertex GetAdjacentVertex(const Face& face, const Edge& edge, bool &success);
-    Vertex GetAdjacentFaceVertex(const Face& face, const Edge& edge, bool &success);
-    
-    // Some more helpful helper functions.
-    int getNumAdjacentFaces(const Edge& edge);
-    Vertex getOtherBoundaryVertice(Vertex &a, Edge &e);
-    Vertex getOtherVertex(Edge &edge, Vertex &v);
-
-    
-    void performTriangulation(WingedEdge &mesh,
-                                    Vertex &v1, Vertex &v2, Vertex &v3,
-                                    Vertex &v4, Vertex &v5, Vertex &v6);
-  
-    // Returns the squared euclidean distance between the two vertices.
-    float computeSqrOffset(Vertex v1,Vertex v2);
 
-    
     /*
-     * Special Derivation capable routine helper functions.
+     * The same subdivisions, written into mesh instead of a new mesh. derivations may be NULL.
+     * mesh keeps the capacity of its arrays, so subdividing back and forth between two meshes with the same scratch
+     * does not allocate once they have grown to the finest level.
+     * REQUIRES : mesh is not this mesh.
+     */
+    void ButterflySubdivide(WingedEdge &mesh, SubdivisionScratch &scratch, Derivations *derivations = NULL, ThreadPool *pool = NULL);
+    void LinearSubdivide(WingedEdge &mesh, SubdivisionScratch &scratch, Derivations *derivations = NULL, ThreadPool *pool = NULL);
+    void SillyPascalSubdivide(WingedEdge &mesh, SubdivisionScratch &scratch, Derivations *derivations = NULL, ThreadPool *pool = NULL);
+    void BoundaryTrianglularSubdivide(WingedEdge &mesh, SubdivisionScratch &scratch, Derivations *derivations, float min_len = -1);
+    void AdaptiveButterflySubdivide(WingedEdge &mesh, SubdivisionScratch &scratch, Derivations *derivations,
+                                    float tolerance, float max_len = -1, int max_faces = -1, ThreadPool *pool = NULL);
+    void BoundaryRefine(WingedEdge &mesh, SubdivisionScratch &scratch, Derivations *derivations,
+                        float precision, int max_vertices = -1);
+
+private:
+
+    // The internal subdivision algorithms that take options and subdivide based on the user's wishes.
+    // They write the result into mesh. derivations and pool may be NULL.
+    void Subdivide(bool linear, bool pascal, WingedEdge &mesh, SubdivisionScratch &scratch, Derivations *derivations,
+                   ThreadPool *pool);
+    void BoundarySubdivide(float min_len, WingedEdge &mesh, SubdivisionScratch &scratch, Derivations *derivations);
+    void AdaptiveSubdivide(float tolerance, float max_len, int max_faces, WingedEdge &mesh, SubdivisionScratch &scratch,
+                           Derivations *derivations, ThreadPool *pool);
+    void RefineBoundary(float precision, int max_vertices, WingedEdge &mesh, SubdivisionScratch &scratch,
+                        Derivations *derivations);
+
+    // Marks the edges that AdaptiveSubdivide() splits, split[e] is the half edge to split e with or -1.
+    void AdaptiveEdges(float tolerance, float max_len, int max_faces, std::vector<int> &split, ThreadPool *pool) const;
+
+    // Computes the stencil that the midpoint of the half edge's edge is interpolated with.
+    void EdgeStencil(int halfEdge, bool linear, Stencil &stencil) const;
+    void BoundaryStencil(int halfEdge, Stencil &stencil) const;
+
+    // Evaluates a stencil computed by EdgeStencil.
+    Vertex EvaluateStencil(const Stencil &stencil) const;
+
+    // Whether the pascal subdivision leaves out the face, because none of its edges are on the boundary.
+    bool IsPascalInterior(int face) const;
+
+    // Adds the midpoint of every edge e with split[e] != -1 to mesh, using the stencil of the half edge split[e].
+    // scratch.midpoints[e] is set to the index of the midpoint, or -1.
+    void SubdivideEdges(const std::vector<int> &split, bool linear, WingedEdge &mesh,
+                        SubdivisionScratch &scratch, Derivations *derivations, ThreadPool *pool) const;
+
+
+    // -- Half Edge transversal helper functions.
+
+    int Next(int h) const { return halfEdges[h].next; }
+    int Prev(int h) const { return halfEdges[halfEdges[h].next].next; }
+
+    // Returns the vertex of the face opposite to the given half edge.
+    int OppositeVertex(int h) const { return halfEdges[Prev(h)].vertex; }
+
+    // Return the boundary neighbours of the start and the end of h along the boundary next to h, or -1.
+    int PreviousBoundaryVertex(int h) const;
+    int NextBoundaryVertex(int h) const;
+
+    // The boundary half edges that end at the start of h and that start at the end of h, or -1.
+    int PreviousBoundaryEdge(int h) const;
+    int NextBoundaryEdge(int h) const;
+
+    /* Lists the neighbours of the origin of h in order around it, starting with the end of h, and returns the valence.
+     * Returns -1 if the origin is a boundary vertex or its faces are not consistently oriented.
+     * REQUIRES : ring has room for MAX_VALENCE + 1 vertices, the walk stops once it has found more than MAX_VALENCE.
      */
-    // Computes interpolated vertices.
-    Vertex SubdivideBoundaryEdge(Edge& e, std::map<Vertex, std::vector<Vertex> > &derivations);
-    
-    WingedEdge Subdivide(bool linear, bool pascal, std::map<Vertex, std::vector<Vertex> > &derivations);
-    Vertex     SubdivideEdge(const Face& f1, Edge& e, Vertex b1, bool linear,
-                             std::map<Vertex, std::vector<Vertex> > &derivations);
+    int VertexRing(int h, int *ring) const;
+
+    // Returns the boundary vertex adjacent to a that is not b, or a if there is none.
+    int getOtherBoundaryVertice(int a, int b) const;
+
+    void performTriangulation(WingedEdge &mesh,
+                              int v1, int v2, int v3,
+                              int v4, int v5, int v6);
+
+    // Returns the squared euclidean distance between the two vertices.
+    float computeSqrOffset(Vertex v1,Vertex v2) const;
 };
 
 /* end */
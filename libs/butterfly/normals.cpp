@@ -0,0 +1,166 @@
+#include <cmath>
+#include "normals.hpp"
+#include "error.hpp"
+
+namespace gfx
+{
+
+    // Faces and vertices per chunk of the parallel loops.
+    static const int NORMAL_GRAIN = 2048;
+
+    static inline void cross(const float *a, const float *b, float *out)
+    {
+        out[0] = a[1]*b[2] - a[2]*b[1];
+        out[1] = a[2]*b[0] - a[0]*b[2];
+        out[2] = a[0]*b[1] - a[1]*b[0];
+    }
+
+    static inline float dot(const float *a, const float *b)
+    {
+        return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+    }
+
+    // Scales v to unit length, or leaves it at zero.
+    static inline void normalize(float *v)
+    {
+        float length = std::sqrt(dot(v, v));
+
+        if(length > 0)
+        {
+            v[0] /= length;
+            v[1] /= length;
+            v[2] /= length;
+        }
+    }
+
+    void VertexFaces::Build(const uint32_t *indices, int num_indices, int num_vertices)
+    {
+        num_faces = num_indices/3;
+        triangles.assign(indices, indices + 3*num_faces);
+
+        // -- Count the faces of every vertex, then place them in ascending order.
+        offsets.assign(num_vertices + 1, 0);
+
+        for(int k = 0; k < 3*num_faces; k++)
+        {
+            if(triangles[k] >= (uint32_t)num_vertices)
+            {
+                throw RuntimeError("VertexFaces Error: A triangle index is out of range.");
+            }
+
+            offsets[triangles[k] + 1]++;
+        }
+
+        for(int v = 0; v < num_vertices; v++)
+        {
+            offsets[v + 1] += offsets[v];
+        }
+
+        faces.resize(3*num_faces);
+        std::vector<int> next(offsets.begin(), offsets.end() - 1);
+
+        for(int k = 0; k < 3*num_faces; k++)
+        {
+            faces[next[triangles[k]]++] = k/3;
+        }
+    }
+
+    void VertexFaces::ComputeNormals(const float *positions, int stride, float *normals, int normal_stride,
+                                     const float *texcoords, int texcoord_stride, float *tangents, int tangent_stride,
+                                     ThreadPool *pool)
+    {
+        bool with_tangents = tangents != NULL && texcoords != NULL;
+        int  width = with_tangents ? 9 : 3;
+
+        face_vectors.resize((size_t)num_faces*width);
+
+        // -- The vectors of every face. The cross product of two edges is twice the area along the normal.
+        ParallelFor(pool, 0, num_faces, NORMAL_GRAIN, [&](int begin, int end)
+        {
+            for(int f = begin; f < end; f++)
+            {
+                const uint32_t *t = &triangles[3*f];
+                const float *p0 = positions + (size_t)t[0]*stride;
+                const float *p1 = positions + (size_t)t[1]*stride;
+                const float *p2 = positions + (size_t)t[2]*stride;
+
+                float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+                float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+
+                float *out = &face_vectors[(size_t)f*width];
+                cross(e1, e2, out);
+
+                if(!with_tangents)
+                {
+                    continue;
+                }
+
+                // Solve e1 = du1 u + dv1 v, e2 = du2 u + dv2 v for the texture space directions u and v.
+                const float *t0 = texcoords + (size_t)t[0]*texcoord_stride;
+                const float *t1 = texcoords + (size_t)t[1]*texcoord_stride;
+                const float *t2 = texcoords + (size_t)t[2]*texcoord_stride;
+
+                float du1 = t1[0] - t0[0], dv1 = t1[1] - t0[1];
+                float du2 = t2[0] - t0[0], dv2 = t2[1] - t0[1];
+
+                float det = du1*dv2 - du2*dv1;
+                float r   = det != 0 ? 1/det : 0;
+
+                for(int c = 0; c < 3; c++)
+                {
+                    out[3 + c] = (e1[c]*dv2 - e2[c]*dv1)*r;
+                    out[6 + c] = (e2[c]*du1 - e1[c]*du2)*r;
+                }
+            }
+        });
+
+        // -- Gather the vectors of the faces around every vertex.
+        ParallelFor(pool, 0, NumVertices(), NORMAL_GRAIN, [&](int begin, int end)
+        {
+            for(int v = begin; v < end; v++)
+            {
+                float sum[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+                for(int k = offsets[v]; k < offsets[v + 1]; k++)
+                {
+                    const float *vectors = &face_vectors[(size_t)faces[k]*width];
+
+                    for(int c = 0; c < width; c++)
+                    {
+                        sum[c] += vectors[c];
+                    }
+                }
+
+                float *n = normals + (size_t)v*normal_stride;
+                normalize(sum);
+                n[0] = sum[0];
+                n[1] = sum[1];
+                n[2] = sum[2];
+
+                if(!with_tangents)
+                {
+                    continue;
+                }
+
+                // Gram-Schmidt the u direction against the normal.
+                float *u = sum + 3;
+                float d  = dot(sum, u);
+                u[0] -= sum[0]*d;
+                u[1] -= sum[1]*d;
+                u[2] -= sum[2]*d;
+                normalize(u);
+
+                float bitangent[3];
+                cross(sum, u, bitangent);
+
+                float *t = tangents + (size_t)v*tangent_stride;
+                t[0] = u[0];
+                t[1] = u[1];
+                t[2] = u[2];
+                t[3] = dot(bitangent, sum + 6) < 0 ? -1.0f : 1.0f;
+            }
+        });
+    }
+
+    /* end */
+}
@@ -0,0 +1,51 @@
+#ifndef __GFX_NORMALS_HPP
+#define __GFX_NORMALS_HPP
+
+#include <stdint.h>
+#include <vector>
+#include "thread_pool.hpp"
+
+namespace gfx
+{
+
+/* The faces around every vertex of a triangle mesh, in compressed sparse row form.
+ *
+ * The lists only depend on the topology, so they are built once and reused for every new set of positions.
+ * Normals are gathered per vertex from a per face pass, so every vertex writes only its own outputs
+ * and the results do not depend on the thread count.
+ */
+class VertexFaces
+{
+public:
+    VertexFaces() : num_faces(0) { offsets.push_back(0); }
+
+    // indices holds num_indices / 3 triangles of vertices below num_vertices.
+    void Build(const uint32_t *indices, int num_indices, int num_vertices);
+
+    int NumVertices() const { return offsets.size() - 1; }
+    int NumFaces() const { return num_faces; }
+
+    /* Writes the smooth normal of every vertex, the normalized sum of the area weighted normals of its faces.
+     * Vertices without faces get a zero normal.
+     *
+     * If tangents is not NULL, texcoords holds u, v per vertex and tangents receives x, y, z, w per vertex :
+     * the texture space u direction made orthogonal to the normal, and w = -1 where the v direction is mirrored.
+     */
+    void ComputeNormals(const float *positions, int stride, float *normals, int normal_stride,
+                        const float *texcoords, int texcoord_stride, float *tangents, int tangent_stride,
+                        ThreadPool *pool);
+
+private:
+    int num_faces;
+
+    std::vector<uint32_t> triangles;
+    std::vector<int> offsets;
+    std::vector<int> faces;
+
+    // The area weighted normal of every face, followed by its u and v directions if tangents are computed.
+    std::vector<float> face_vectors;
+};
+
+/* end */
+}
+#endif
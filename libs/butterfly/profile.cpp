@@ -0,0 +1,144 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "profile.hpp"
+
+namespace gfx
+{
+
+    // The events of one thread.
+    struct ThreadProfile
+    {
+        ProfileStats current; // The call in progress.
+        ProfileStats last;    // The last finished call.
+
+        std::vector<ProfileEvent> trace;
+        bool tracing;
+
+        int depth;
+
+        ThreadProfile() : tracing(false), depth(0) {}
+    };
+
+    static ThreadProfile &threadProfile()
+    {
+        static thread_local ThreadProfile profile;
+        return profile;
+    }
+
+    // Microseconds since the first call.
+    static double now()
+    {
+        typedef std::chrono::steady_clock clock;
+        static const clock::time_point epoch = clock::now();
+
+        return std::chrono::duration<double, std::micro>(clock::now() - epoch).count();
+    }
+
+    double ProfileStats::Total() const
+    {
+        return events.empty() ? 0 : events[0].duration;
+    }
+
+    double ProfileStats::Total(const char *name) const
+    {
+        double total = 0;
+
+        for(size_t i = 0; i < events.size(); i++)
+        {
+            if(std::strcmp(events[i].name, name) == 0)
+            {
+                total += events[i].duration;
+            }
+        }
+
+        return total;
+    }
+
+    const ProfileStats &LastProfile()
+    {
+        return threadProfile().last;
+    }
+
+    void StartTrace()
+    {
+        ThreadProfile &profile = threadProfile();
+        profile.trace.clear();
+        profile.tracing = true;
+    }
+
+    bool StopTrace(const char *path)
+    {
+        ThreadProfile &profile = threadProfile();
+        profile.tracing = false;
+
+        FILE *file = std::fopen(path, "w");
+
+        if(file == NULL)
+        {
+            return false;
+        }
+
+        // Complete events ("ph": "X") carry their own duration, the nesting follows from the times.
+        std::fprintf(file, "{\"traceEvents\": [\n");
+
+        for(size_t i = 0; i < profile.trace.size(); i++)
+        {
+            const ProfileEvent &event = profile.trace[i];
+
+            std::fprintf(file, "  {\"name\": \"%s\", \"cat\": \"butterfly\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+                               "\"pid\": 1, \"tid\": 1, \"args\": {\"level\": %d}}%s\n",
+                         event.name, event.start, event.duration, event.level, i + 1 < profile.trace.size() ? "," : "");
+        }
+
+        std::fprintf(file, "], \"displayTimeUnit\": \"ms\"}\n");
+
+        bool written = std::ferror(file) == 0;
+        return std::fclose(file) == 0 && written;
+    }
+
+    ProfileScope::ProfileScope(const char *name, int level)
+    {
+        ThreadProfile &profile = threadProfile();
+
+        // A new call replaces the events of the call before it.
+        if(profile.depth == 0)
+        {
+            profile.current.Clear();
+        }
+
+        ProfileEvent e;
+        e.name     = name;
+        e.level    = level;
+        e.depth    = profile.depth++;
+        e.duration = 0;
+        e.start    = now();
+
+        event = profile.current.events.size();
+        profile.current.events.push_back(e);
+    }
+
+    ProfileScope::~ProfileScope()
+    {
+        ThreadProfile &profile = threadProfile();
+
+        ProfileEvent &e = profile.current.events[event];
+        e.duration = now() - e.start;
+
+        if(--profile.depth > 0)
+        {
+            return;
+        }
+
+        // -- The call is done.
+        if(profile.tracing)
+        {
+            profile.trace.insert(profile.trace.end(), profile.current.events.begin(), profile.current.events.end());
+        }
+
+        // The two lists take turns, so they keep their capacity.
+        profile.last.events.swap(profile.current.events);
+    }
+
+    /* end */
+}
@@ -0,0 +1,81 @@
+#ifndef __GFX_PROFILE_HPP
+#define __GFX_PROFILE_HPP
+
+#include <vector>
+
+namespace gfx
+{
+
+/* Per phase timings of the subdivision calls.
+ *
+ * With GFX_PROFILE defined, the phases of the Subdivider, of WingedEdge and of ofxButterfly record a timed event
+ * on the thread that runs them, along with the subdivision level where there is one.
+ * Without it the scopes compile to nothing, and LastProfile() and the traces stay empty.
+ *
+ * An outermost scope and everything inside it form a call, such as one subdivideButterfly() or fixMesh().
+ * LastProfile() holds the events of the last call on the calling thread.
+ * StartTrace() and StopTrace() collect every call in between into a Chrome trace event file,
+ * which chrome://tracing and Perfetto show as a timeline of frames.
+ */
+struct ProfileEvent
+{
+    const char *name;  // A string literal.
+    int    level;      // The subdivision level, or -1.
+    int    depth;      // The number of enclosing events.
+    double start;      // Microseconds since the first event of the process.
+    double duration;   // Microseconds.
+};
+
+struct ProfileStats
+{
+    // The events in the order they started, every event is followed by the events inside it.
+    std::vector<ProfileEvent> events;
+
+    // The time of the whole call.
+    double Total() const;
+
+    // The total time of the events with the given name, at any level and depth.
+    double Total(const char *name) const;
+
+    void Clear() { events.clear(); }
+};
+
+// The events of the last call on this thread.
+const ProfileStats &LastProfile();
+
+// Starts collecting the events of every call on this thread, and drops the events of an earlier trace.
+void StartTrace();
+
+// Writes the events collected since StartTrace() as Chrome trace event JSON and stops collecting.
+// Returns false if the file can not be written.
+bool StopTrace(const char *path);
+
+// Times the rest of the enclosing block as an event, use it through GFX_PROFILE_SCOPE() and GFX_PROFILE_LEVEL().
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char *name, int level = -1);
+    ~ProfileScope();
+
+private:
+    ProfileScope(const ProfileScope &);
+    ProfileScope &operator=(const ProfileScope &);
+
+    int event; // The index of the event in the current call.
+};
+
+/* end */
+}
+
+#define GFX_PROFILE_JOIN2(a, b) a##b
+#define GFX_PROFILE_JOIN(a, b) GFX_PROFILE_JOIN2(a, b)
+
+#ifdef GFX_PROFILE
+#define GFX_PROFILE_SCOPE(name) gfx::ProfileScope GFX_PROFILE_JOIN(profile_scope_, __LINE__)(name)
+#define GFX_PROFILE_LEVEL(name, level) gfx::ProfileScope GFX_PROFILE_JOIN(profile_scope_, __LINE__)(name, level)
+#else
+#define GFX_PROFILE_SCOPE(name)
+#define GFX_PROFILE_LEVEL(name, level)
+#endif
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef __GFX_SHARED_ARRAY_HPP
+#define __GFX_SHARED_ARRAY_HPP
+
+#include <stddef.h>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace gfx
+{
+
+/* A read mostly array that owns its values, or reads them in place from memory that a shared owner keeps alive,
+ * such as a mapped cache file or a cached topology.
+ * Shared values are never written, the first change to a sharing array copies them into its own storage.
+ * Copies of a sharing array share the same values, copies of an owning array copy them.
+ */
+template <class T>
+class SharedArray
+{
+public:
+    typedef const T *const_iterator;
+
+    SharedArray() : items(NULL), count(0) {}
+
+    SharedArray(const SharedArray &array) : values(array.values), owner(array.owner), items(array.items), count(array.count)
+    {
+        if(!owner)
+        {
+            Update();
+        }
+    }
+
+    SharedArray(SharedArray &&array) : items(NULL), count(0) { swap(array); }
+
+    SharedArray &operator=(SharedArray array)
+    {
+        swap(array);
+        return *this;
+    }
+
+    void swap(SharedArray &array)
+    {
+        values.swap(array.values);
+        owner.swap(array.owner);
+        std::swap(items, array.items);
+        std::swap(count, array.count);
+    }
+
+    // Takes the values of array, which gets the values this array owned.
+    void swap(std::vector<T> &array)
+    {
+        values.swap(array);
+        Update();
+    }
+
+    // Reads the size values at data in place, holder keeps them alive.
+    void Share(const std::shared_ptr<const void> &holder, const T *data, size_t size)
+    {
+        std::vector<T>().swap(values);
+        owner = holder;
+        items = size == 0 ? NULL : data;
+        count = size;
+    }
+
+    // Reads the values of array in place, holder keeps the array alive.
+    void Share(const std::shared_ptr<const void> &holder, const SharedArray &array) { Share(holder, array.items, array.count); }
+
+    bool IsShared() const { return (bool)owner; }
+
+    size_t size() const { return count; }
+    bool   empty() const { return count == 0; }
+
+    // The values this array owns, shared values are counted by their owner.
+    size_t capacity() const { return values.capacity(); }
+
+    const T *data() const { return items; }
+    const T &operator[](size_t i) const { return items[i]; }
+    const T &back() const { return items[count - 1]; }
+
+    const_iterator begin() const { return items; }
+    const_iterator end() const { return items + count; }
+
+    // -- Changes, they copy shared values first.
+
+    void clear()
+    {
+        values.clear();
+        Update();
+    }
+
+    void resize(size_t size, const T &value = T())
+    {
+        Edit().resize(size, value);
+        Update();
+    }
+
+    void reserve(size_t size)
+    {
+        Edit().reserve(size);
+        Update();
+    }
+
+    void push_back(const T &value)
+    {
+        Edit().push_back(value);
+        Update();
+    }
+
+    template <class Iterator>
+    void insert(const_iterator position, Iterator first, Iterator last)
+    {
+        size_t index = position - items;
+
+        std::vector<T> &edit = Edit();
+        edit.insert(edit.begin() + index, first, last);
+        Update();
+    }
+
+    template <class Iterator>
+    void assign(Iterator first, Iterator last)
+    {
+        values.assign(first, last);
+        Update();
+    }
+
+private:
+    // The owned values, copied from the shared values if there are any.
+    // The owner is only dropped by Update(), so values given to a change may still point into the shared memory.
+    std::vector<T> &Edit()
+    {
+        if(owner)
+        {
+            values.assign(items, items + count);
+        }
+
+        return values;
+    }
+
+    // Reads the owned values.
+    void Update()
+    {
+        owner.reset();
+        items = values.empty() ? NULL : &values[0];
+        count = values.size();
+    }
+
+    std::vector<T> values;
+    std::shared_ptr<const void> owner;
+
+    const T *items;
+    size_t   count;
+};
+
+/* end */
+}
+#endif
@@ -0,0 +1,12 @@
+#ifndef __GFX_SIMD_HPP
+#define __GFX_SIMD_HPP
+
+// The SSE and AVX kernels are compiled with target attributes and picked at runtime,
+// so the library does not need to be built with -mavx2.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define GFX_SIMD_X86
+#define GFX_TARGET(x) __attribute__((target(x)))
+#include <immintrin.h>
+#endif
+
+#endif
@@ -0,0 +1,592 @@
+#include <algorithm>
+#include <cmath>
+#include "stencil.hpp"
+#include "error.hpp"
+#include "profile.hpp"
+#include "simd.hpp"
+
+namespace gfx
+{
+
+    void Stencil::Add(int source, float weight)
+    {
+        for(size_t k = 0; k < sources.size(); k++)
+        {
+            if(sources[k] == source)
+            {
+                weights[k] += weight;
+                return;
+            }
+        }
+
+        sources.push_back(source);
+        weights.push_back(weight);
+    }
+
+    Stencil &AddDerivation(Derivations &derivations, int vertex)
+    {
+        Derivations::iterator derivation = derivations.lower_bound(vertex);
+
+        if(derivation != derivations.end() && derivation -> first == vertex)
+        {
+            return derivation -> second;
+        }
+
+        Stencil stencil(derivations.get_allocator().arena);
+        return derivations.insert(derivation, Derivations::value_type(vertex, std::move(stencil))) -> second;
+    }
+
+    // The weights of every valence, laid out one after another.
+    struct ValenceTable
+    {
+        float weights[(MAX_VALENCE + 3)*(MAX_VALENCE - 2)/2];
+        int   offsets[MAX_VALENCE + 1];
+
+        ValenceTable()
+        {
+            const double pi = 3.14159265358979323846;
+
+            int offset = 0;
+            for(int k = 3; k <= MAX_VALENCE; k++)
+            {
+                offsets[k] = offset;
+                float *w = weights + offset;
+
+                for(int j = 0; j < k; j++)
+                {
+                    if(k == 3)
+                    {
+                        w[j] = j == 0 ? 5/12.0 : -1/12.0;
+                    }
+                    else if(k == 4)
+                    {
+                        w[j] = j == 0 ? 3/8.0 : j == 2 ? -1/8.0 : 0;
+                    }
+                    else
+                    {
+                        w[j] = (0.25 + std::cos(2*pi*j/k) + 0.5*std::cos(4*pi*j/k))/k;
+                    }
+                }
+
+                offset += k;
+            }
+        }
+    };
+
+    const float *ValenceWeights(int valence)
+    {
+        static const ValenceTable table;
+
+        if(valence < 3 || valence > MAX_VALENCE)
+        {
+            return NULL;
+        }
+
+        return table.weights + table.offsets[valence];
+    }
+
+    // Rows per chunk of a parallel level.
+    static const int ROW_GRAIN = 1024;
+
+    // The composed rows of one chunk of a level.
+    struct ComposedRows
+    {
+        std::vector<int>   sizes;
+        std::vector<int>   sources;
+        std::vector<float> weights;
+    };
+
+    StencilTable StencilTable::Compose(float prune, ThreadPool *pool) const
+    {
+        GFX_PROFILE_SCOPE("compose_stencils");
+
+        StencilTable direct;
+        direct.Clear(num_control);
+
+        int begin = 0;
+        for(size_t l = 0; l < levels.size(); l++)
+        {
+            int end = levels[l];
+
+            // The chunks are fixed, so the composed rows do not depend on the pool.
+            int num_chunks = (end - begin + ROW_GRAIN - 1)/ROW_GRAIN;
+            std::vector<ComposedRows> chunks(num_chunks);
+
+            ParallelFor(pool, 0, num_chunks, 1, [&](int chunk_begin, int chunk_end)
+            {
+                // A dense accumulator over the control vertices, with the list of the ones a row touches.
+                std::vector<double> sum(num_control, 0.0);
+                std::vector<bool>   used(num_control, false);
+                std::vector<int>    touched;
+
+                for(int c = chunk_begin; c < chunk_end; c++)
+                {
+                    ComposedRows &rows = chunks[c];
+                    int last = std::min(end, begin + (c + 1)*ROW_GRAIN);
+
+                    for(int r = begin + c*ROW_GRAIN; r < last; r++)
+                    {
+                        touched.clear();
+
+                        for(int k = offsets[r]; k < offsets[r + 1]; k++)
+                        {
+                            int    source = sources[k];
+                            double w      = weights[k];
+
+                            // A control vertex, or a vertex of an earlier level that is already composed.
+                            int count = 1;
+                            const int   *taps    = &source;
+                            const float *factors = NULL;
+
+                            if(source >= num_control)
+                            {
+                                int row   = source - num_control;
+                                int first = direct.offsets[row];
+                                count     = direct.offsets[row + 1] - first;
+                                taps      = &direct.sources[first];
+                                factors   = &direct.weights[first];
+                            }
+
+                            for(int j = 0; j < count; j++)
+                            {
+                                int v = taps[j];
+
+                                if(!used[v])
+                                {
+                                    used[v] = true;
+                                    touched.push_back(v);
+                                }
+
+                                sum[v] += factors != NULL ? w*factors[j] : w;
+                            }
+                        }
+
+                        // -- Prune the row, the dropped weight goes to the largest tap.
+                        std::sort(touched.begin(), touched.end());
+
+                        int largest = -1;
+                        for(size_t j = 0; j < touched.size(); j++)
+                        {
+                            if(largest == -1 || std::fabs(sum[touched[j]]) > std::fabs(sum[largest]))
+                            {
+                                largest = touched[j];
+                            }
+                        }
+
+                        double dropped = 0;
+                        for(size_t j = 0; j < touched.size(); j++)
+                        {
+                            int v = touched[j];
+
+                            if(v != largest && std::fabs(sum[v]) <= prune)
+                            {
+                                dropped += sum[v];
+                                sum[v] = 0;
+                            }
+                        }
+
+                        sum[largest] += dropped;
+
+                        int size = 0;
+                        for(size_t j = 0; j < touched.size(); j++)
+                        {
+                            int v = touched[j];
+
+                            if(v == largest || sum[v] != 0)
+                            {
+                                rows.sources.push_back(v);
+                                rows.weights.push_back(sum[v]);
+                                size++;
+                            }
+
+                            sum[v]  = 0;
+                            used[v] = false;
+                        }
+
+                        rows.sizes.push_back(size);
+                    }
+                }
+            });
+
+            // -- Append the chunks in order.
+            for(int c = 0; c < num_chunks; c++)
+            {
+                const ComposedRows &rows = chunks[c];
+
+                for(size_t i = 0; i < rows.sizes.size(); i++)
+                {
+                    direct.offsets.push_back(direct.offsets.back() + rows.sizes[i]);
+                }
+
+                direct.sources.insert(direct.sources.end(), rows.sources.begin(), rows.sources.end());
+                direct.weights.insert(direct.weights.end(), rows.weights.begin(), rows.weights.end());
+            }
+
+            begin = end;
+        }
+
+        direct.levels.push_back(direct.offsets.size() - 1);
+        return direct;
+    }
+
+    void SparseMatrix::RowIndices(std::vector<int> &rows) const
+    {
+        rows.resize(values.size());
+
+        for(int r = 0; r < num_rows; r++)
+        {
+            std::fill(rows.begin() + offsets[r], rows.begin() + offsets[r + 1], r);
+        }
+    }
+
+    void StencilTable::LevelMatrix(int level, SparseMatrix &matrix) const
+    {
+        if(level < 0 || level >= NumLevels())
+        {
+            throw RuntimeError("StencilTable Error: There is no such subdivision level.");
+        }
+
+        int begin = level > 0 ? levels[level - 1] : 0;
+        int end   = levels[level];
+
+        matrix.num_columns = num_control + begin;
+        matrix.num_rows    = num_control + end;
+
+        matrix.offsets.clear();
+        matrix.columns.clear();
+        matrix.values.clear();
+
+        matrix.offsets.reserve(matrix.num_rows + 1);
+        matrix.columns.reserve(matrix.num_columns + offsets[end] - offsets[begin]);
+        matrix.values.reserve(matrix.num_columns + offsets[end] - offsets[begin]);
+
+        matrix.offsets.push_back(0);
+
+        // -- The earlier vertices are copied.
+        for(int i = 0; i < matrix.num_columns; i++)
+        {
+            matrix.columns.push_back(i);
+            matrix.values.push_back(1.0f);
+            matrix.offsets.push_back(matrix.columns.size());
+        }
+
+        // -- The rows of the level.
+        for(int r = begin; r < end; r++)
+        {
+            matrix.columns.insert(matrix.columns.end(), sources.begin() + offsets[r], sources.begin() + offsets[r + 1]);
+            matrix.values.insert(matrix.values.end(), weights.begin() + offsets[r], weights.begin() + offsets[r + 1]);
+            matrix.offsets.push_back(matrix.columns.size());
+        }
+    }
+
+    void StencilTable::Clear(int num_control_vertices)
+    {
+        num_control = num_control_vertices;
+
+        offsets.clear();
+        sources.clear();
+        weights.clear();
+        levels.clear();
+
+        offsets.push_back(0);
+    }
+
+    void StencilTable::Share(const std::shared_ptr<const void> &holder, const StencilTable &table)
+    {
+        num_control = table.num_control;
+
+        offsets.Share(holder, table.offsets);
+        sources.Share(holder, table.sources);
+        weights.Share(holder, table.weights);
+        levels.Share(holder, table.levels);
+    }
+
+    void StencilTable::Append(const Derivations &derivations, int num_vertices)
+    {
+        GFX_PROFILE_SCOPE("append_stencils");
+
+        for(int i = NumVertices(); i < num_vertices; i++)
+        {
+            Derivations::const_iterator derivation = derivations.find(i);
+
+            if(derivation == derivations.end())
+            {
+                throw RuntimeError("Error in the topology Derivation data structures.");
+            }
+
+            const Stencil &stencil = derivation -> second;
+
+            if(stencil.sources.empty() || stencil.sources.size() != stencil.weights.size())
+            {
+                throw RuntimeError("Error in the topology Derivation data structures.");
+            }
+
+            sources.insert(sources.end(), stencil.sources.begin(), stencil.sources.end());
+            weights.insert(weights.end(), stencil.weights.begin(), stencil.weights.end());
+
+            offsets.push_back(sources.size());
+        }
+
+        levels.push_back(offsets.size() - 1);
+    }
+
+
+    // Evaluates row r with a compile time vertex width, so the accumulators stay in registers.
+    template <int W>
+    static inline void applyRow(const StencilTable &table, float *data, int stride, int r)
+    {
+        const int   *sources = table.sources.empty() ? NULL : &table.sources[0];
+        const float *weights = table.weights.empty() ? NULL : &table.weights[0];
+
+        float sum[W];
+        for(int c = 0; c < W; c++)
+        {
+            sum[c] = 0;
+        }
+
+        for(int k = table.offsets[r]; k < table.offsets[r + 1]; k++)
+        {
+            const float *source = data + sources[k]*stride;
+            float w = weights[k];
+
+            for(int c = 0; c < W; c++)
+            {
+                sum[c] += source[c]*w;
+            }
+        }
+
+        float *output = data + (table.NumControlVertices() + r)*stride;
+        for(int c = 0; c < W; c++)
+        {
+            output[c] = sum[c];
+        }
+    }
+
+    // Evaluates the rows [begin, end).
+    template <int W>
+    static void applyRows(const StencilTable &table, float *data, int stride, int begin, int end)
+    {
+        for(int r = begin; r < end; r++)
+        {
+            applyRow<W>(table, data, stride, r);
+        }
+    }
+
+    template <int W>
+    static void applyLevels(const StencilTable &table, float *data, int stride, ThreadPool *pool)
+    {
+        if(pool == NULL)
+        {
+            applyRows<W>(table, data, stride, 0, table.offsets.size() - 1);
+            return;
+        }
+
+        // The levels run one after another, the rows of a level are split between the threads.
+        // The rows of a level read only earlier levels and write only themselves, so every split gives the same result.
+        int begin = 0;
+        for(size_t l = 0; l < table.levels.size(); l++)
+        {
+            int end = table.levels[l];
+
+            pool -> ParallelFor(begin, end, ROW_GRAIN, [&](int first, int last)
+            {
+                applyRows<W>(table, data, stride, first, last);
+            });
+
+            begin = end;
+        }
+    }
+
+    /* Wide vertices, such as several poses interleaved per vertex, are summed in register blocks of channels.
+     * Every channel is still summed in tap order from 0, so each one gets the same result as a narrow width.
+     */
+    typedef void (*WideRows)(const StencilTable &table, float *data, int width, int stride, int begin, int end);
+
+    // Sums the channels [first, width) of row r one at a time.
+    static inline void wideTail(const StencilTable &table, const float *data, int stride, int r, int first, int width,
+                                float *output)
+    {
+        for(int c = first; c < width; c++)
+        {
+            float sum = 0;
+            for(int k = table.offsets[r]; k < table.offsets[r + 1]; k++)
+            {
+                sum += data[table.sources[k]*stride + c]*table.weights[k];
+            }
+
+            output[c] = sum;
+        }
+    }
+
+    static void wideScalar(const StencilTable &table, float *data, int width, int stride, int begin, int end)
+    {
+        for(int r = begin; r < end; r++)
+        {
+            wideTail(table, data, stride, r, 0, width, data + (table.NumControlVertices() + r)*stride);
+        }
+    }
+
+#ifdef GFX_SIMD_X86
+
+    GFX_TARGET("sse2")
+    static void wideSSE(const StencilTable &table, float *data, int width, int stride, int begin, int end)
+    {
+        for(int r = begin; r < end; r++)
+        {
+            float *output = data + (table.NumControlVertices() + r)*stride;
+
+            int c = 0;
+            for(; c + 4 <= width; c += 4)
+            {
+                __m128 sum = _mm_setzero_ps();
+
+                for(int k = table.offsets[r]; k < table.offsets[r + 1]; k++)
+                {
+                    __m128 source = _mm_loadu_ps(data + table.sources[k]*stride + c);
+                    sum = _mm_add_ps(sum, _mm_mul_ps(source, _mm_set1_ps(table.weights[k])));
+                }
+
+                _mm_storeu_ps(output + c, sum);
+            }
+
+            wideTail(table, data, stride, r, c, width, output);
+        }
+    }
+
+    GFX_TARGET("avx")
+    static void wideAVX(const StencilTable &table, float *data, int width, int stride, int begin, int end)
+    {
+        for(int r = begin; r < end; r++)
+        {
+            float *output = data + (table.NumControlVertices() + r)*stride;
+
+            // Blocks of 3 registers fit the 24 channels of 8 interleaved poses.
+            int c = 0;
+            for(; c + 24 <= width; c += 24)
+            {
+                __m256 sum0 = _mm256_setzero_ps();
+                __m256 sum1 = _mm256_setzero_ps();
+                __m256 sum2 = _mm256_setzero_ps();
+
+                for(int k = table.offsets[r]; k < table.offsets[r + 1]; k++)
+                {
+                    const float *source = data + table.sources[k]*stride + c;
+                    __m256 w = _mm256_set1_ps(table.weights[k]);
+
+                    sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(source +  0), w));
+                    sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(source +  8), w));
+                    sum2 = _mm256_add_ps(sum2, _mm256_mul_ps(_mm256_loadu_ps(source + 16), w));
+                }
+
+                _mm256_storeu_ps(output + c +  0, sum0);
+                _mm256_storeu_ps(output + c +  8, sum1);
+                _mm256_storeu_ps(output + c + 16, sum2);
+            }
+
+            for(; c + 8 <= width; c += 8)
+            {
+                __m256 sum = _mm256_setzero_ps();
+
+                for(int k = table.offsets[r]; k < table.offsets[r + 1]; k++)
+                {
+                    __m256 source = _mm256_loadu_ps(data + table.sources[k]*stride + c);
+                    sum = _mm256_add_ps(sum, _mm256_mul_ps(source, _mm256_set1_ps(table.weights[k])));
+                }
+
+                _mm256_storeu_ps(output + c, sum);
+            }
+
+            wideTail(table, data, stride, r, c, width, output);
+        }
+    }
+
+#endif
+
+    static WideRows bestWideRows()
+    {
+#ifdef GFX_SIMD_X86
+        __builtin_cpu_init();
+
+        if(__builtin_cpu_supports("avx"))
+        {
+            return wideAVX;
+        }
+
+        if(__builtin_cpu_supports("sse2"))
+        {
+            return wideSSE;
+        }
+#endif
+        return wideScalar;
+    }
+
+    static void applyWideLevels(const StencilTable &table, float *data, int width, int stride, ThreadPool *pool)
+    {
+        static const WideRows rows = bestWideRows();
+
+        int begin = 0;
+        for(size_t l = 0; l < table.levels.size(); l++)
+        {
+            int end = table.levels[l];
+
+            ParallelFor(pool, begin, end, ROW_GRAIN, [&](int first, int last)
+            {
+                rows(table, data, width, stride, first, last);
+            });
+
+            begin = end;
+        }
+    }
+
+    template <int W>
+    static void applyListedRows(const StencilTable &table, const std::vector<int> &rows,
+                                float *data, int stride, ThreadPool *pool)
+    {
+        // The listed rows of a level lie between the first rows of it and of the next level.
+        int begin = 0;
+        for(size_t l = 0; l < table.levels.size(); l++)
+        {
+            int end = std::lower_bound(rows.begin() + begin, rows.end(), table.levels[l]) - rows.begin();
+
+            ParallelFor(pool, begin, end, ROW_GRAIN, [&](int first, int last)
+            {
+                for(int i = first; i < last; i++)
+                {
+                    applyRow<W>(table, data, stride, rows[i]);
+                }
+            });
+
+            begin = end;
+        }
+    }
+
+    void StencilTable::ApplyRows(const std::vector<int> &rows, float *data, int width, int stride, ThreadPool *pool) const
+    {
+        switch(width)
+        {
+            case 2: applyListedRows<2>(*this, rows, data, stride, pool); return;
+            case 3: applyListedRows<3>(*this, rows, data, stride, pool); return;
+            case 4: applyListedRows<4>(*this, rows, data, stride, pool); return;
+            default: throw RuntimeError("StencilTable Error: Unsupported vertex width.");
+        }
+    }
+
+    void StencilTable::Apply(float *data, int width, int stride, ThreadPool *pool) const
+    {
+        switch(width)
+        {
+            case 2: applyLevels<2>(*this, data, stride, pool); return;
+            case 3: applyLevels<3>(*this, data, stride, pool); return;
+            case 4: applyLevels<4>(*this, data, stride, pool); return;
+        }
+
+        if(width < 1 || width > stride)
+        {
+            throw RuntimeError("StencilTable Error: Unsupported vertex width.");
+        }
+
+        applyWideLevels(*this, data, width, stride, pool);
+    }
+
+    /* end */
+}
@@ -0,0 +1,145 @@
+#ifndef __GFX_STENCIL_HPP
+#define __GFX_STENCIL_HPP
+
+#include <map>
+#include <vector>
+#include "arena.hpp"
+#include "shared_array.hpp"
+#include "thread_pool.hpp"
+
+namespace gfx
+{
+
+// A derived vertex : the weighted sum of its source vertices.
+struct Stencil
+{
+    std::vector<int, ArenaAllocator<int> >     sources;
+    std::vector<float, ArenaAllocator<float> > weights;
+
+    Stencil() {}
+
+    // A stencil whose taps are allocated from the arena.
+    explicit Stencil(Arena *arena) : sources(ArenaAllocator<int>(arena)), weights(ArenaAllocator<float>(arena)) {}
+
+    void Clear() { sources.clear(); weights.clear(); }
+    int Size() const { return sources.size(); }
+
+    // Adds weight to the tap of the source, a new tap is appended if the source is not in the stencil yet.
+    void Add(int source, float weight);
+
+    void swap(Stencil &stencil) { sources.swap(stencil.sources); weights.swap(stencil.weights); }
+};
+
+/* Maps the index of a derived vertex to the stencil it is interpolated with.
+ * The derivations of a level can be allocated from an arena, which is reset once the level has been compiled.
+ */
+typedef ArenaAllocator<std::pair<const int, Stencil> > DerivationAllocator;
+typedef std::map<int, Stencil, std::less<int>, DerivationAllocator> Derivations;
+
+// Derivations whose nodes and stencils are allocated from the arena, or from the heap if arena is NULL.
+inline Derivations ArenaDerivations(Arena *arena) { return Derivations(std::less<int>(), DerivationAllocator(arena)); }
+
+// Returns the stencil of the vertex, a new empty stencil uses the allocator of the derivations.
+Stencil &AddDerivation(Derivations &derivations, int vertex);
+
+// The highest valence with a tabulated modified butterfly stencil.
+static const int MAX_VALENCE = 64;
+
+/* The modified butterfly weights of the neighbours e0 .. e(k-1) of an interior vertex of valence k,
+ * in order around the vertex starting with the other end of the edge. The vertex itself weighs 3/4.
+ *  k = 3  : 5/12, -1/12, -1/12
+ *  k = 4  : 3/8, 0, -1/8, 0
+ *  k >= 5 : (1/4 + cos(2 pi j/k) + cos(4 pi j/k)/2)/k
+ * The weights are tabulated once, returns NULL for valences outside 3 .. MAX_VALENCE.
+ */
+const float *ValenceWeights(int valence);
+
+/* A sparse matrix in compressed sparse row form.
+ * Row r holds the values[offsets[r] .. offsets[r + 1]) at the columns with the same indices.
+ */
+struct SparseMatrix
+{
+    int num_rows;
+    int num_columns;
+
+    std::vector<int>   offsets;
+    std::vector<int>   columns;
+    std::vector<float> values;
+
+    SparseMatrix() : num_rows(0), num_columns(0) {}
+
+    // The row of every value, so rows, columns and values form the coordinate (COO) form of the matrix.
+    void RowIndices(std::vector<int> &rows) const;
+};
+
+/* A flat compressed sparse row table of subdivision stencils.
+ *
+ * The first NumControlVertices() vertices are copied from the control mesh,
+ * every later vertex i is the weighted sum of the vertices
+ * sources[offsets[r] .. offsets[r + 1]) with r = i - NumControlVertices().
+ * Sources always precede the vertex they derive, so the rows can be evaluated in order.
+ *
+ * Every Append() call adds one subdivision level. The rows of a level only read vertices of earlier levels,
+ * so the rows within a level can be evaluated in any order.
+ */
+class StencilTable
+{
+public:
+    SharedArray<int>   offsets;
+    SharedArray<int>   sources;
+    SharedArray<float> weights;
+
+    // The row after the last row of every level.
+    SharedArray<int> levels;
+
+    StencilTable() : num_control(0) { offsets.push_back(0); }
+
+    // Empties the table for a control mesh with the given number of vertices.
+    void Clear(int num_control_vertices);
+
+    // Reads the arrays of table in place instead of copying them, holder keeps table alive.
+    void Share(const std::shared_ptr<const void> &holder, const StencilTable &table);
+
+    // Compiles the derivations of the vertices [NumVertices(), num_vertices) onto the end of the table as a new level.
+    // REQUIRES : the derivations only use vertices of earlier levels.
+    void Append(const Derivations &derivations, int num_vertices);
+
+    /* Returns a table with a single level whose rows only read control vertices,
+     * by substituting the rows of earlier levels into every row.
+     * Weights with a magnitude of at most prune are dropped and added to the largest weight of their row,
+     * so the rows keep their weight sums. Apply() on the result then reads no intermediate vertices,
+     * but rounds differently from the levels, so the results are close rather than identical.
+     * If a pool is given the rows of every level are composed in parallel, with the same results.
+     */
+    StencilTable Compose(float prune = 0, ThreadPool *pool = NULL) const;
+
+    /* Writes the linear map of one level as a matrix, the vertices before the level are the columns
+     * and the vertices after it are the rows. The rows of the earlier vertices copy them.
+     * For a table from Compose() level 0 maps the control vertices to every vertex.
+     */
+    void LevelMatrix(int level, SparseMatrix &matrix) const;
+
+    int NumControlVertices() const { return num_control; }
+    int NumVertices() const { return num_control + offsets.size() - 1; }
+    int NumLevels() const { return levels.size(); }
+
+    /* Derives every non control vertex in place.
+     * data holds NumVertices() vertices of width floats each, stride floats apart.
+     * Widths other than 2 to 4, such as several poses interleaved per vertex, are summed with SIMD across the width.
+     * If a pool is given the rows of every level are spread across its threads, with the same results.
+     * REQUIRES : the control vertices are already in data.
+     */
+    void Apply(float *data, int width, int stride, ThreadPool *pool = NULL) const;
+
+    /* Derives only the given rows in place, the vertices NumControlVertices() + rows[i].
+     * REQUIRES : rows is ascending, and the vertices the rows read are already up to date in data.
+     */
+    void ApplyRows(const std::vector<int> &rows, float *data, int width, int stride, ThreadPool *pool = NULL) const;
+
+private:
+    int num_control;
+};
+
+/* end */
+}
+#endif
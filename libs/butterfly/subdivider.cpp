@@ -0,0 +1,1047 @@
+#include <algorithm>
+#include "subdivider.hpp"
+#include "weld.hpp"
+#include "cache.hpp"
+#include "error.hpp"
+#include "profile.hpp"
+
+namespace gfx
+{
+
+    // Vertices per chunk of the transposes between separate and interleaved streams.
+    static const int VERTEX_GRAIN = 4096;
+
+    Subdivider::Subdivider() :
+        original_vertex_count(0), all_vertices(false), weld_epsilon(0), topology_key(0), fingerprint(0), loaded_topology(false),
+        composed_levels(false), prune_weight(0), mode(EVALUATE_SIMD)
+    {
+    }
+
+    // -- Batch subdivision.
+
+    void Subdivider::SubdivideStart(const float *positions, int num_vertices, int stride,
+                                    const uint32_t *indices, int num_indices)
+    {
+        Start(positions, num_vertices, stride, indices, num_indices);
+        all_vertices = false;
+
+        batch_stencils.Clear(original_vertex_count);
+    }
+
+    void Subdivider::Subdivide(Scheme scheme, int iterations, float pixel_precision)
+    {
+        for(int i = 0; i < iterations; i++)
+        {
+            GFX_PROFILE_LEVEL("level", i + 1);
+
+            // The derivations are only needed to carry attributes along.
+            if(attribute_widths.empty())
+            {
+                SubdivideOnce(scheme, pixel_precision, NULL);
+                continue;
+            }
+
+            level_arena.Reset();
+            Derivations info = ArenaDerivations(&level_arena);
+            SubdivideOnce(scheme, pixel_precision, &info);
+            batch_stencils.Append(info, current_WE.NumVertices());
+        }
+    }
+
+    void Subdivider::SubdivideAdaptive(float tolerance, int iterations, int max_faces, float max_len)
+    {
+        for(int i = 0; i < iterations; i++)
+        {
+            GFX_PROFILE_LEVEL("level", i + 1);
+
+            if(attribute_widths.empty())
+            {
+                current_WE.AdaptiveButterflySubdivide(next_WE, scratch, NULL, tolerance, max_len, max_faces, &pool);
+                current_WE.swap(next_WE);
+                continue;
+            }
+
+            level_arena.Reset();
+            Derivations info = ArenaDerivations(&level_arena);
+            current_WE.AdaptiveButterflySubdivide(next_WE, scratch, &info, tolerance, max_len, max_faces, &pool);
+            current_WE.swap(next_WE);
+            batch_stencils.Append(info, current_WE.NumVertices());
+        }
+    }
+
+    void Subdivider::RefineBoundary(float pixel_precision, int max_vertices)
+    {
+        if(attribute_widths.empty())
+        {
+            current_WE.BoundaryRefine(next_WE, scratch, NULL, pixel_precision, max_vertices);
+            current_WE.swap(next_WE);
+            return;
+        }
+
+        level_arena.Reset();
+        Derivations info = ArenaDerivations(&level_arena);
+        current_WE.BoundaryRefine(next_WE, scratch, &info, pixel_precision, max_vertices);
+        current_WE.swap(next_WE);
+        batch_stencils.Append(info, current_WE.NumVertices());
+    }
+
+    void Subdivider::SubdivideOnce(Scheme scheme, float pixel_precision, Derivations *info)
+    {
+        switch(scheme)
+        {
+            case BUTTERFLY:
+                current_WE.ButterflySubdivide(next_WE, scratch, info, &pool);
+                break;
+            case LINEAR:
+                current_WE.LinearSubdivide(next_WE, scratch, info, &pool);
+                break;
+            case BOUNDARY:
+                current_WE.BoundaryTrianglularSubdivide(next_WE, scratch, info, pixel_precision);
+                break;
+            case PASCAL:
+                current_WE.SillyPascalSubdivide(next_WE, scratch, info, &pool);
+                break;
+            default:
+                throw RuntimeError("Malformed type. We do not know how to subdivide the mesh in the given way.");
+        }
+
+        // The levels take turns in the two meshes, which keep their capacity.
+        current_WE.swap(next_WE);
+    }
+
+    // -- Vertex attributes.
+
+    int Subdivider::AddAttribute(const float *values, int width, int stride)
+    {
+        if(width < 1 || width > stride)
+        {
+            throw RuntimeError("Subdivider Error: An attribute needs between 1 and stride floats per vertex.");
+        }
+
+        if(!all_vertices && batch_stencils.NumVertices() != current_WE.NumVertices())
+        {
+            throw RuntimeError("Subdivider Error: Attributes must be added before the mesh is subdivided.");
+        }
+
+        attribute_widths.push_back(width);
+        attribute_values.push_back(std::vector<float>((size_t)original_vertex_count*width));
+
+        std::vector<float> &copy = attribute_values.back();
+
+        for(int i = 0; i < original_vertex_count; i++)
+        {
+            std::copy(values + (size_t)i*stride, values + (size_t)i*stride + width, copy.begin() + (size_t)i*width);
+        }
+
+        return attribute_widths.size() - 1;
+    }
+
+    void Subdivider::ClearAttributes()
+    {
+        attribute_values.clear();
+        attribute_widths.clear();
+    }
+
+    void Subdivider::GetAttributes(const AttributeStream *outputs)
+    {
+        GFX_PROFILE_SCOPE("get_attributes");
+
+        if(all_vertices)
+        {
+            UpdateComposition();
+        }
+
+        const StencilTable &table = all_vertices ? ActiveStencils() : batch_stencils;
+
+        std::vector<int> index_map;
+        int len = OutputIndices(index_map);
+        int num_vertices = loaded_topology ? len : current_WE.NumVertices();
+
+        if(table.NumVertices() != num_vertices)
+        {
+            throw RuntimeError("Subdivider Error: The attributes were added after the mesh was subdivided.");
+        }
+
+        int num_attributes = attribute_widths.size();
+        int width = 0;
+
+        for(int a = 0; a < num_attributes; a++)
+        {
+            width += attribute_widths[a];
+        }
+
+        if(width == 0 || num_vertices == 0)
+        {
+            return;
+        }
+
+        // -- Interleave the control values, derive every attribute at once, then write them out in mesh order.
+        packed.resize((size_t)num_vertices*width);
+
+        for(int a = 0, offset = 0; a < num_attributes; offset += attribute_widths[a++])
+        {
+            int attribute_width = attribute_widths[a];
+            const float *values = &attribute_values[a][0];
+
+            for(int v = 0; v < original_vertex_count; v++)
+            {
+                std::copy(values + (size_t)v*attribute_width, values + (size_t)(v + 1)*attribute_width,
+                          packed.begin() + (size_t)v*width + offset);
+            }
+        }
+
+        table.Apply(&packed[0], width, width, &pool);
+
+        ParallelFor(&pool, 0, num_vertices, VERTEX_GRAIN, [&](int begin, int end)
+        {
+            for(int v = begin; v < end; v++)
+            {
+                int output = index_map.empty() ? v : index_map[v];
+
+                if(output == -1)
+                {
+                    continue;
+                }
+
+                const float *p = &packed[(size_t)v*width];
+
+                for(int a = 0; a < num_attributes; a++)
+                {
+                    const AttributeStream &stream = outputs[a];
+                    std::copy(p, p + stream.width, stream.data + (size_t)output*stream.stride);
+                    p += stream.width;
+                }
+            }
+        });
+    }
+
+    // -- Topology caching.
+
+    void Subdivider::TopologyStart(const float *positions, int num_vertices, int stride,
+                                   const uint32_t *indices, int num_indices)
+    {
+        Start(positions, num_vertices, stride, indices, num_indices);
+        all_vertices = true;
+
+        stencils.Clear(original_vertex_count);
+        composed.Clear(original_vertex_count);
+        composed_levels = false;
+        CompileStencils();
+    }
+
+    void Subdivider::TopologySubdivide(Scheme scheme, int iterations)
+    {
+        if(loaded_topology)
+        {
+            throw RuntimeError("Subdivider Error: A loaded topology can not be subdivided further.");
+        }
+
+        for(int i = 0; i < iterations; i++)
+        {
+            GFX_PROFILE_LEVEL("level", i + 1);
+
+            level_arena.Reset();
+            Derivations info = ArenaDerivations(&level_arena);
+            SubdivideOnce(scheme, -1, &info);
+
+            // The new vertices are appended to the old ones, so their indices are already the mesh indices.
+            // note: that all vertices/indexes in the derivation must be old, becuase of the subdivision algorithm.
+            stencils.Append(info, current_WE.NumVertices());
+            topology_key = SchemeKey(topology_key, scheme);
+        }
+    }
+
+    void Subdivider::TopologyEnd(bool compose, float prune)
+    {
+        GFX_PROFILE_SCOPE("topology_end");
+
+        composed_levels = compose;
+        prune_weight    = prune;
+
+        if(compose)
+        {
+            composed = stencils.Compose(prune, &pool);
+        }
+
+        CompileStencils();
+    }
+
+    void Subdivider::CompileStencils()
+    {
+        evaluator.Compile(ActiveStencils());
+        dependents = StencilDependents();
+        vertex_faces = VertexFaces();
+        snapshot.clear();
+    }
+
+    // -- Mesh input and output.
+
+    void Subdivider::Start(const float *positions, int num_vertices, int stride,
+                           const uint32_t *indices, int num_indices)
+    {
+        GFX_PROFILE_SCOPE("to_winged_edge");
+
+        original_vertex_count = num_vertices;
+        current_WE.Clear();
+        ClearAttributes();
+
+        loaded_topology = false;
+        loaded_positions.clear();
+        loaded_indices.clear();
+
+        // -- Add all of the vertices.
+        current_WE.vertices.reserve(num_vertices);
+
+        for(int i = 0; i < num_vertices; i++)
+        {
+            const float *p = positions + i*stride;
+            current_WE.AddVertex(p[0], p[1], p[2]);
+        }
+
+        // -- Weld coincident vertices, the faces use the lowest index of every welded group.
+        WeldVertices(positions, num_vertices, stride, weld_epsilon, weld_map);
+
+        // Construct the half edge relationships (Add the triangular faces.)
+        current_WE.halfEdges.reserve(num_indices);
+
+        for(int i = 0; i + 2 < num_indices; i += 3)
+        {
+            uint32_t i1 = indices[i + 0];
+            uint32_t i2 = indices[i + 1];
+            uint32_t i3 = indices[i + 2];
+
+            if(i1 >= (uint32_t)num_vertices || i2 >= (uint32_t)num_vertices || i3 >= (uint32_t)num_vertices)
+            {
+                throw RuntimeError("Subdivider Error: A triangle index is out of range.");
+            }
+
+            current_WE.AddFace(weld_map[i1], weld_map[i2], weld_map[i3]);
+        }
+
+        current_WE.BuildTopology(scratch);
+
+        topology_key = FacesKey(num_vertices, indices, num_indices, weld_map);
+        fingerprint  = Fingerprint(num_vertices, indices, num_indices);
+    }
+
+    uint64_t Subdivider::FacesKey(int num_vertices, const uint32_t *indices, int num_indices, const std::vector<int> &welds)
+    {
+        uint64_t key = HashBytes(&num_vertices, sizeof(num_vertices));
+
+        // Only whole triangles are added to the mesh.
+        for(int i = 0; i < num_indices - num_indices % 3; i++)
+        {
+            uint32_t index = welds[indices[i]];
+            key = HashBytes(&index, sizeof(index), key);
+        }
+
+        return key;
+    }
+
+    uint64_t Subdivider::SchemeKey(uint64_t key, Scheme scheme)
+    {
+        int32_t value = scheme;
+        return HashBytes(&value, sizeof(value), key);
+    }
+
+    int Subdivider::OutputIndices(std::vector<int> &index_map) const
+    {
+        if(loaded_topology)
+        {
+            index_map.clear();
+            return stencils.NumVertices();
+        }
+
+        int num_vertices = current_WE.NumVertices();
+        int num_faces    = current_WE.NumFaces();
+
+        index_map.assign(num_vertices, all_vertices ? 0 : -1);
+
+        for(int i = 0; i < original_vertex_count; i++)
+        {
+            index_map[i] = 0;
+        }
+
+        for(int f = 0; f < num_faces && !all_vertices; f++)
+        {
+            index_map[current_WE.FaceVertex(f, 0)] = 0;
+            index_map[current_WE.FaceVertex(f, 1)] = 0;
+            index_map[current_WE.FaceVertex(f, 2)] = 0;
+        }
+
+        // Number the output vertices, the original vertices keep their indices.
+        int len = 0;
+        for(int i = 0; i < num_vertices; i++)
+        {
+            if(index_map[i] != -1)
+            {
+                index_map[i] = len++;
+            }
+        }
+
+        return len;
+    }
+
+    void Subdivider::GetMeshSize(int &num_vertices, int &num_indices) const
+    {
+        std::vector<int> index_map;
+
+        num_vertices = OutputIndices(index_map);
+        num_indices  = loaded_topology ? loaded_indices.size() : 3*current_WE.NumFaces();
+    }
+
+    void Subdivider::GetMesh(float *positions, int stride, uint32_t *indices) const
+    {
+        GFX_PROFILE_SCOPE("from_winged_edge");
+
+        std::vector<int> index_map;
+
+        int len          = OutputIndices(index_map);
+        int num_vertices = current_WE.NumVertices();
+        int num_faces    = current_WE.NumFaces();
+
+        // -- A loaded topology stores its output mesh as it is, or only its control positions.
+        if(loaded_topology)
+        {
+            int stored = loaded_positions.size()/3;
+
+            for(int i = 0; i < stored; i++)
+            {
+                const float *p = &loaded_positions[3*i];
+                float *q = positions + i*stride;
+                q[0] = p[0];
+                q[1] = p[1];
+                q[2] = p[2];
+            }
+
+            if(stored < len)
+            {
+                ActiveStencils().Apply(positions, 3, stride);
+            }
+
+            std::copy(loaded_indices.begin(), loaded_indices.end(), indices);
+            return;
+        }
+
+        // -- Copy the vertices.
+        for(int i = 0; i < num_vertices; i++)
+        {
+            if(index_map[i] == -1)
+            {
+                continue;
+            }
+
+            const Vertex &v = current_WE.vertices[i];
+            float *p = positions + index_map[i]*stride;
+            p[0] = v.X();
+            p[1] = v.Y();
+            p[2] = v.Z();
+        }
+
+        // We are going to sort the triangles by lowest indice in linear time.
+        // This allows the triangles associated with lower indices to be added to the mesh before those with higher indices,
+        // which allows for the arbitrary depth ordering of the triangles to more closely match the mesh builder's artistic
+        // intent.
+
+        // -- Count the triangles of every lowest index.
+        std::vector<int> offsets(len + 1, 0);
+
+        for(int f = 0; f < num_faces; f++)
+        {
+            int i1 = index_map[current_WE.FaceVertex(f, 0)];
+            int i2 = index_map[current_WE.FaceVertex(f, 1)];
+            int i3 = index_map[current_WE.FaceVertex(f, 2)];
+
+            offsets[std::min(std::min(i1, i2), i3) + 1]++;
+        }
+
+        for(int i = 0; i < len; i++)
+        {
+            offsets[i + 1] += offsets[i];
+        }
+
+        // -- Place every triangle in its sorted position, the triangles of an index keep their order.
+        for(int f = 0; f < num_faces; f++)
+        {
+            int i1 = index_map[current_WE.FaceVertex(f, 0)];
+            int i2 = index_map[current_WE.FaceVertex(f, 1)];
+            int i3 = index_map[current_WE.FaceVertex(f, 2)];
+
+            uint32_t *triangle = indices + 3*offsets[std::min(std::min(i1, i2), i3)]++;
+            triangle[0] = i1;
+            triangle[1] = i2;
+            triangle[2] = i3;
+        }
+    }
+
+    // -- Recomputing subdivisions.
+
+    void Subdivider::FixMesh(const float *positions, int num_vertices, int stride,
+                             float *subdivided, int num_subdivided, int subdivided_stride,
+                             const AttributeStream *attributes, int num_attributes)
+    {
+        GFX_PROFILE_SCOPE("fix_mesh");
+
+        if(num_vertices != stencils.NumControlVertices() || num_subdivided != stencils.NumVertices())
+        {
+            throw RuntimeError("fixMesh Error: The meshes do not match the topology given to topology_start.");
+        }
+
+        // Move all of the original vertices to the divided mesh.
+        snapshot.resize(3*num_vertices);
+
+        for(int i = 0; i < num_vertices; i++)
+        {
+            const float *p = positions + i*stride;
+            float *q = subdivided + i*subdivided_stride;
+            q[0] = p[0];
+            q[1] = p[1];
+            q[2] = p[2];
+
+            float *s = &snapshot[3*i];
+            s[0] = p[0];
+            s[1] = p[1];
+            s[2] = p[2];
+        }
+
+        if(num_subdivided == 0)
+        {
+            return;
+        }
+
+        if(num_attributes == 0)
+        {
+            ApplyStencils(subdivided, 3, subdivided_stride);
+            return;
+        }
+
+        // -- Derive the positions along with the attributes.
+        std::vector<AttributeStream> streams(1 + num_attributes);
+
+        AttributeStream position = {subdivided, 3, subdivided_stride};
+        streams[0] = position;
+        std::copy(attributes, attributes + num_attributes, streams.begin() + 1);
+
+        ApplyStencils(&streams[0], streams.size());
+    }
+
+    void Subdivider::FixMeshBatch(const float *positions, int num_vertices, int stride, int num_poses,
+                                  float *subdivided, int num_subdivided, int subdivided_stride)
+    {
+        GFX_PROFILE_SCOPE("fix_mesh_batch");
+
+        if(num_vertices != stencils.NumControlVertices() || num_subdivided != stencils.NumVertices())
+        {
+            throw RuntimeError("fixMesh Error: The meshes do not match the topology given to topology_start.");
+        }
+
+        if(num_subdivided == 0)
+        {
+            return;
+        }
+
+        UpdateComposition();
+
+        const StencilTable &table = ActiveStencils();
+
+        // A local copy, since std::min() takes its arguments by reference and the class constant has no definition.
+        const int batch_poses = BATCH_POSES;
+
+        for(int first = 0; first < num_poses; first += batch_poses)
+        {
+            int poses = std::min(batch_poses, num_poses - first);
+            int width = 3*poses;
+
+            batch.resize((size_t)num_subdivided*width);
+
+            // -- Interleave the control positions of the poses per vertex.
+            ParallelFor(&pool, 0, num_vertices, VERTEX_GRAIN, [&](int begin, int end)
+            {
+                for(int p = 0; p < poses; p++)
+                {
+                    const float *pose = positions + (size_t)(first + p)*num_vertices*stride;
+
+                    for(int v = begin; v < end; v++)
+                    {
+                        float *q = &batch[(size_t)v*width + 3*p];
+                        q[0] = pose[v*stride + 0];
+                        q[1] = pose[v*stride + 1];
+                        q[2] = pose[v*stride + 2];
+                    }
+                }
+            });
+
+            table.Apply(&batch[0], width, width, &pool);
+
+            // -- Split the poses again.
+            ParallelFor(&pool, 0, num_subdivided, VERTEX_GRAIN, [&](int begin, int end)
+            {
+                for(int p = 0; p < poses; p++)
+                {
+                    float *pose = subdivided + (size_t)(first + p)*num_subdivided*subdivided_stride;
+
+                    for(int v = begin; v < end; v++)
+                    {
+                        const float *q = &batch[(size_t)v*width + 3*p];
+                        pose[v*subdivided_stride + 0] = q[0];
+                        pose[v*subdivided_stride + 1] = q[1];
+                        pose[v*subdivided_stride + 2] = q[2];
+                    }
+                }
+            });
+        }
+    }
+
+    void Subdivider::FixMesh(const float *positions, int num_vertices, int stride, const int *changed, int num_changed,
+                             float *subdivided, int num_subdivided, int subdivided_stride)
+    {
+        GFX_PROFILE_SCOPE("fix_mesh_changed");
+
+        if(num_vertices != stencils.NumControlVertices() || num_subdivided != stencils.NumVertices())
+        {
+            throw RuntimeError("fixMesh Error: The meshes do not match the topology given to topology_start.");
+        }
+
+        UpdateComposition();
+
+        const StencilTable &table = ActiveStencils();
+
+        if(dependents.NumVertices() != table.NumVertices())
+        {
+            dependents.Build(table);
+        }
+
+        // -- Move the changed original vertices.
+        snapshot.resize(3*num_vertices);
+
+        for(int i = 0; i < num_changed; i++)
+        {
+            int v = changed[i];
+
+            if(v < 0 || v >= num_vertices)
+            {
+                throw RuntimeError("fixMesh Error: A changed vertex index is out of range.");
+            }
+
+            const float *p = positions + v*stride;
+            float *q = subdivided + v*subdivided_stride;
+            q[0] = p[0];
+            q[1] = p[1];
+            q[2] = p[2];
+
+            float *s = &snapshot[3*v];
+            s[0] = p[0];
+            s[1] = p[1];
+            s[2] = p[2];
+        }
+
+        // -- Derive the vertices that depend on them.
+        dependents.AffectedRows(changed, num_changed, affected_rows);
+        table.ApplyRows(affected_rows, subdivided, 3, subdivided_stride, &pool);
+    }
+
+    void Subdivider::FixChangedMesh(const float *positions, int num_vertices, int stride,
+                                    float *subdivided, int num_subdivided, int subdivided_stride)
+    {
+        GFX_PROFILE_SCOPE("fix_changed_mesh");
+
+        if(snapshot.size() != 3*(size_t)num_vertices)
+        {
+            FixMesh(positions, num_vertices, stride, subdivided, num_subdivided, subdivided_stride);
+            return;
+        }
+
+        changed_vertices.clear();
+        DiffPositions(positions, num_vertices, stride, &snapshot[0], changed_vertices);
+
+        if(!changed_vertices.empty())
+        {
+            FixMesh(positions, num_vertices, stride, &changed_vertices[0], changed_vertices.size(),
+                    subdivided, num_subdivided, subdivided_stride);
+        }
+    }
+
+    void Subdivider::ComputeNormals(const float *positions, int stride, float *normals, int normal_stride,
+                                    const float *texcoords, int texcoord_stride, float *tangents, int tangent_stride)
+    {
+        GFX_PROFILE_SCOPE("normals");
+
+        int num_vertices = stencils.NumVertices();
+
+        if(!all_vertices)
+        {
+            throw RuntimeError("Subdivider Error: Normals are computed for the mesh given to topology_start.");
+        }
+
+        if(vertex_faces.NumVertices() != num_vertices)
+        {
+            if(loaded_topology)
+            {
+                vertex_faces.Build(loaded_indices.data(), loaded_indices.size(), num_vertices);
+            }
+            else
+            {
+                // Every vertex is kept, so the mesh indices are the indices of current_WE.
+                std::vector<uint32_t> indices(3*current_WE.NumFaces());
+
+                for(size_t k = 0; k < indices.size(); k++)
+                {
+                    indices[k] = current_WE.halfEdges[k].vertex;
+                }
+
+                vertex_faces.Build(indices.empty() ? NULL : &indices[0], indices.size(), num_vertices);
+            }
+        }
+
+        vertex_faces.ComputeNormals(positions, stride, normals, normal_stride,
+                                    texcoords, texcoord_stride, tangents, tangent_stride, &pool);
+    }
+
+    void Subdivider::UpdateComposition()
+    {
+        // Stencils recorded after the last TopologyEnd().
+        if(composed_levels && composed.NumVertices() != stencils.NumVertices())
+        {
+            composed = stencils.Compose(prune_weight, &pool);
+        }
+    }
+
+    void Subdivider::ApplyStencils(float *data, int width, int stride)
+    {
+        GFX_PROFILE_SCOPE("apply_stencils");
+
+        UpdateComposition();
+
+        const StencilTable &table = ActiveStencils();
+
+        // Four or more floats per vertex fill the vector registers of the table's own kernels,
+        // which read each source once for all of its channels instead of gathering every channel.
+        if(mode == EVALUATE_SIMD && width < 4)
+        {
+            if(evaluator.NumVertices() != table.NumVertices())
+            {
+                evaluator.Compile(table);
+            }
+
+            evaluator.Apply(data, width, stride, &pool);
+        }
+        else
+        {
+            table.Apply(data, width, stride, &pool);
+        }
+    }
+
+    void Subdivider::ApplyStencils(const AttributeStream *streams, int num_streams)
+    {
+        GFX_PROFILE_SCOPE("apply_stencils");
+
+        UpdateComposition();
+
+        const StencilTable &table = ActiveStencils();
+
+        int num_vertices = table.NumVertices();
+        int num_control  = table.NumControlVertices();
+        int width = 0;
+
+        for(int s = 0; s < num_streams; s++)
+        {
+            if(streams[s].width < 1 || streams[s].width > streams[s].stride)
+            {
+                throw RuntimeError("Subdivider Error: A stream needs between 1 and stride floats per vertex.");
+            }
+
+            width += streams[s].width;
+        }
+
+        if(width == 0 || num_vertices == num_control)
+        {
+            return;
+        }
+
+        packed.resize((size_t)num_vertices*width);
+
+        // -- Interleave the control values of the streams per vertex.
+        ParallelFor(&pool, 0, num_control, VERTEX_GRAIN, [&](int begin, int end)
+        {
+            for(int v = begin; v < end; v++)
+            {
+                float *p = &packed[(size_t)v*width];
+
+                for(int s = 0; s < num_streams; s++)
+                {
+                    const float *q = streams[s].data + (size_t)v*streams[s].stride;
+                    std::copy(q, q + streams[s].width, p);
+                    p += streams[s].width;
+                }
+            }
+        });
+
+        // The packed streams are at least 4 floats wide, so the table's kernels sum them in one pass in either mode.
+        table.Apply(&packed[0], width, width, &pool);
+
+        // -- Split the derived vertices again.
+        ParallelFor(&pool, num_control, num_vertices, VERTEX_GRAIN, [&](int begin, int end)
+        {
+            for(int v = begin; v < end; v++)
+            {
+                const float *p = &packed[(size_t)v*width];
+
+                for(int s = 0; s < num_streams; s++)
+                {
+                    std::copy(p, p + streams[s].width, streams[s].data + (size_t)v*streams[s].stride);
+                    p += streams[s].width;
+                }
+            }
+        });
+    }
+
+    void Subdivider::GetOperator(SparseMatrix &matrix, int level, float prune)
+    {
+        if(level != -1)
+        {
+            stencils.LevelMatrix(level, matrix);
+            return;
+        }
+
+        stencils.Compose(prune, &pool).LevelMatrix(0, matrix);
+    }
+
+    // -- Persistent topology caches.
+
+    void Subdivider::SaveTopology(const char *path)
+    {
+        int num_vertices, num_indices;
+        GetMeshSize(num_vertices, num_indices);
+
+        std::vector<float>    positions(3*num_vertices);
+        std::vector<uint32_t> indices(num_indices);
+
+        if(num_vertices > 0)
+        {
+            GetMesh(&positions[0], 3, indices.empty() ? NULL : &indices[0]);
+        }
+
+        SaveTopologyCache(path, topology_key, stencils, indices);
+    }
+
+    bool Subdivider::LoadTopology(const char *path, const float *positions, int num_vertices, int stride,
+                                  const uint32_t *indices, int num_indices, const Scheme *schemes, int num_schemes)
+    {
+        GFX_PROFILE_SCOPE("load_topology");
+
+        std::vector<int> welds;
+        uint64_t key = InputKey(positions, num_vertices, stride, indices, num_indices, schemes, num_schemes, welds);
+
+        std::shared_ptr<TopologyCache::Entry> entry = std::make_shared<TopologyCache::Entry>();
+
+        if(!LoadTopologyCache(path, key, entry -> stencils, entry -> indices) ||
+           entry -> stencils.NumControlVertices() != num_vertices)
+        {
+            return false;
+        }
+
+        entry -> key = key;
+        entry -> weld_map.swap(welds);
+
+        Restore(entry, Fingerprint(num_vertices, indices, num_indices), positions, stride, true);
+        return true;
+    }
+
+    // -- In memory topology caches.
+
+    void Subdivider::StoreTopology(TopologyCache &cache)
+    {
+        std::shared_ptr<TopologyCache::Entry> entry = std::make_shared<TopologyCache::Entry>();
+        entry -> key         = topology_key;
+        entry -> fingerprint = fingerprint;
+        entry -> weld_map    = weld_map;
+        entry -> compose     = composed_levels;
+        entry -> prune       = prune_weight;
+
+        if(loaded_topology)
+        {
+            entry -> indices = loaded_indices;
+        }
+        else
+        {
+            int num_vertices, num_indices;
+            GetMeshSize(num_vertices, num_indices);
+
+            std::vector<float>    positions(3*num_vertices);
+            std::vector<uint32_t> triangles(num_indices);
+
+            if(num_vertices > 0)
+            {
+                GetMesh(&positions[0], 3, triangles.empty() ? NULL : &triangles[0]);
+            }
+
+            entry -> indices.swap(triangles);
+        }
+
+        // -- The tables move into the entry and are read back from it in place.
+        std::swap(entry -> stencils, stencils);
+        stencils.Share(entry, entry -> stencils);
+
+        if(composed_levels)
+        {
+            std::swap(entry -> composed, composed);
+            composed.Share(entry, entry -> composed);
+        }
+
+        cache.Insert(entry);
+    }
+
+    bool Subdivider::RestoreTopology(TopologyCache &cache, const float *positions, int num_vertices, int stride,
+                                     const uint32_t *indices, int num_indices, const Scheme *schemes, int num_schemes)
+    {
+        GFX_PROFILE_SCOPE("restore_topology");
+
+        std::vector<int> welds;
+        uint64_t key = InputKey(positions, num_vertices, stride, indices, num_indices, schemes, num_schemes, welds);
+
+        // The current topology needs no restoring, all_vertices tells it apart from a batch subdivision.
+        if(all_vertices && key == topology_key && stencils.NumControlVertices() == num_vertices && NumLevels() == num_schemes)
+        {
+            return true;
+        }
+
+        std::shared_ptr<const TopologyCache::Entry> entry = cache.Find(key);
+
+        if(!entry || entry -> stencils.NumControlVertices() != num_vertices)
+        {
+            return false;
+        }
+
+        Restore(entry, entry -> fingerprint, positions, stride, true);
+        return true;
+    }
+
+    bool Subdivider::RestoreTopology(TopologyCache &cache, const float *positions, int num_vertices, int stride,
+                                     const uint32_t *indices, int num_indices, int num_subdivided)
+    {
+        GFX_PROFILE_SCOPE("restore_topology");
+
+        uint64_t print = Fingerprint(num_vertices, indices, num_indices);
+
+        if(all_vertices && print == fingerprint &&
+           stencils.NumControlVertices() == num_vertices && stencils.NumVertices() == num_subdivided)
+        {
+            return true;
+        }
+
+        if(cache.Count(print, num_subdivided) > 1)
+        {
+            throw RuntimeError("Subdivider Error: Several cached topologies match the meshes, restore one by its schemes.");
+        }
+
+        std::shared_ptr<const TopologyCache::Entry> entry = cache.Find(print, num_subdivided);
+
+        if(!entry || entry -> stencils.NumControlVertices() != num_vertices)
+        {
+            return false;
+        }
+
+        // FixMesh() follows, so the positions are not derived twice.
+        Restore(entry, print, positions, stride, false);
+        return true;
+    }
+
+    uint64_t Subdivider::Fingerprint(int num_vertices, const uint32_t *indices, int num_indices)
+    {
+        uint64_t print = HashBytes(&num_vertices, sizeof(num_vertices));
+        return num_indices == 0 ? print : HashBytes(indices, sizeof(uint32_t)*num_indices, print);
+    }
+
+    uint64_t Subdivider::InputKey(const float *positions, int num_vertices, int stride,
+                                  const uint32_t *indices, int num_indices, const Scheme *schemes, int num_schemes,
+                                  std::vector<int> &welds) const
+    {
+        // -- The key of the faces as TopologyStart() would weld them, followed by the schemes.
+        WeldVertices(positions, num_vertices, stride, weld_epsilon, welds);
+
+        for(int i = 0; i < num_indices - num_indices % 3; i++)
+        {
+            if(indices[i] >= (uint32_t)num_vertices)
+            {
+                throw RuntimeError("Subdivider Error: A triangle index is out of range.");
+            }
+        }
+
+        uint64_t key = FacesKey(num_vertices, indices, num_indices, welds);
+
+        for(int i = 0; i < num_schemes; i++)
+        {
+            key = SchemeKey(key, schemes[i]);
+        }
+
+        return key;
+    }
+
+    void Subdivider::Restore(const std::shared_ptr<const TopologyCache::Entry> &entry, uint64_t print,
+                             const float *positions, int stride, bool evaluate)
+    {
+        // -- Take the place of a compiled topology, current_WE keeps its capacity for the next start.
+        original_vertex_count = entry -> stencils.NumControlVertices();
+        current_WE.Clear();
+        all_vertices = true;
+        topology_key = entry -> key;
+        fingerprint  = print;
+        weld_map     = entry -> weld_map;
+
+        stencils.Share(entry, entry -> stencils);
+        composed_levels = entry -> compose;
+        prune_weight    = entry -> prune;
+
+        if(composed_levels)
+        {
+            composed.Share(entry, entry -> composed);
+        }
+        else
+        {
+            composed.Clear(original_vertex_count);
+        }
+
+        ClearAttributes();
+        CompileStencils();
+
+        loaded_indices.Share(entry, entry -> indices);
+
+        if(evaluate)
+        {
+            loaded_positions.resize(3*stencils.NumVertices());
+
+            if(!loaded_positions.empty())
+            {
+                FixMesh(positions, original_vertex_count, stride, &loaded_positions[0], stencils.NumVertices(), 3);
+            }
+        }
+        else
+        {
+            loaded_positions.resize(3*original_vertex_count);
+
+            for(int i = 0; i < original_vertex_count; i++)
+            {
+                std::copy(positions + i*stride, positions + i*stride + 3, &loaded_positions[3*i]);
+            }
+        }
+
+        loaded_topology = true;
+    }
+
+    void Subdivider::SetWeldTolerance(float epsilon)
+    {
+        weld_epsilon = epsilon;
+    }
+
+    void Subdivider::SetEvaluationMode(EvaluationMode evaluation)
+    {
+        mode = evaluation;
+    }
+
+    void Subdivider::SetThreadCount(int threads)
+    {
+        pool.SetThreads(threads);
+    }
+
+    /* end */
+}
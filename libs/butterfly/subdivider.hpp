@@ -0,0 +1,358 @@
+#ifndef __GFX_SUBDIVIDER_HPP
+#define __GFX_SUBDIVIDER_HPP
+
+#include <stdint.h>
+#include <vector>
+#include "mesh.hpp"
+#include "stencil.hpp"
+#include "evaluator.hpp"
+#include "dependents.hpp"
+#include "normals.hpp"
+#include "topology_cache.hpp"
+#include "thread_pool.hpp"
+
+namespace gfx
+{
+
+// width floats of per vertex data, the values of consecutive vertices stride floats apart.
+struct AttributeStream
+{
+    float *data;
+    int    width;
+    int    stride;
+};
+
+/* The subdivision engine behind ofxButterfly, without any openFrameworks or OpenGL dependencies.
+ *
+ * Meshes come in and go out as plain arrays : positions are x, y, z float triples a stride of floats apart,
+ * and triangles are 3 consecutive uint32_t vertex indices.
+ *
+ * Batch subdivision : SubdivideStart(), any number of Subdivide() calls, then GetMeshSize() and GetMesh().
+ *
+ * Topology caching : TopologyStart(), any number of TopologySubdivide() calls, TopologyEnd(), then GetMeshSize()
+ * and GetMesh(). FixMesh() recomputes the subdivided positions for new positions of the control mesh,
+ * and ApplyStencils() does the same for any other per vertex data.
+ *
+ * Attributes such as texture coordinates or colors are carried through both pipelines : AddAttribute() after the start,
+ * then GetAttributes() along with GetMesh(). Every attribute is derived with the stencils of the positions.
+ *
+ * The original vertices always keep their indices in the subdivided mesh.
+ */
+class Subdivider
+{
+public:
+    enum Scheme {BUTTERFLY, LINEAR, BOUNDARY, PASCAL};
+
+    // EVALUATE_SIMD runs the stencils through a StencilEvaluator, EVALUATE_SCALAR through the StencilTable.
+    // Both give identical results.
+    enum EvaluationMode {EVALUATE_SCALAR, EVALUATE_SIMD};
+
+    Subdivider();
+
+    // -- Batch subdivision.
+
+    // Vertices at identical positions, or within the weld tolerance, are welded together.
+    // The faces use the lowest of their indices, the other vertices stay in the mesh without faces.
+    void SubdivideStart(const float *positions, int num_vertices, int stride,
+                        const uint32_t *indices, int num_indices);
+
+    // pixel_precision is only used by the BOUNDARY scheme, see WingedEdge::BoundaryTrianglularSubdivide().
+    void Subdivide(Scheme scheme, int iterations = 1, float pixel_precision = -1);
+
+    /* Butterfly iterations that only refine where the surface is not yet smooth, see WingedEdge::AdaptiveButterflySubdivide().
+     * max_faces caps the face count of the result of every iteration, -1 leaves it unbounded.
+     * The refined edges depend on the positions, so there is no topology caching version.
+     */
+    void SubdivideAdaptive(float tolerance, int iterations = 1, int max_faces = -1, float max_len = -1);
+
+    // Refines the boundary to the given precision in one call, see WingedEdge::BoundaryRefine().
+    void RefineBoundary(float pixel_precision, int max_vertices = -1);
+
+    // -- Vertex attributes.
+
+    /* Registers width floats per control vertex, stride floats apart, and returns the index of the attribute.
+     * The values are copied. The attributes are cleared by SubdivideStart() and TopologyStart().
+     * REQUIRES : After SubdivideStart() the attributes are added before the first Subdivide().
+     */
+    int AddAttribute(const float *values, int width, int stride);
+
+    void ClearAttributes();
+
+    int NumAttributes() const { return attribute_widths.size(); }
+    int AttributeWidth(int attribute) const { return attribute_widths[attribute]; }
+
+    /* Writes every attribute of the current mesh, in the vertex order of GetMesh().
+     * outputs[i] receives attribute i and has room for the vertex count of GetMeshSize().
+     * All of the attributes are derived together, in one pass over the stencils.
+     */
+    void GetAttributes(const AttributeStream *outputs);
+
+    // -- Topology caching.
+
+    void TopologyStart(const float *positions, int num_vertices, int stride,
+                       const uint32_t *indices, int num_indices);
+
+    // Subdivides the mesh and records the derivation of every new vertex as one more stencil level.
+    void TopologySubdivide(Scheme scheme, int iterations = 1);
+
+    /* Prepares the recorded stencils for FixMesh() and ApplyStencils().
+     * With compose the levels are collapsed into one operator from the control vertices, see StencilTable::Compose(),
+     * so FixMesh() reads no intermediate vertices. This costs a one time compile and rows with more taps,
+     * and the results differ from the levels by rounding and by the pruned weights.
+     */
+    void TopologyEnd(bool compose = false, float prune = 1e-6f);
+
+    // -- The current mesh.
+
+    /* After SubdivideStart() derived vertices that are no longer used by any face are left out.
+     * After TopologyStart() every vertex is kept, since later vertices may be derived from them.
+     */
+    void GetMeshSize(int &num_vertices, int &num_indices) const;
+
+    // REQUIRES : positions and indices have room for the sizes given by GetMeshSize().
+    void GetMesh(float *positions, int stride, uint32_t *indices) const;
+
+    /* Copies the num_vertices control positions into subdivided and derives the rest of its num_subdivided positions.
+     * The given attributes are derived in the same pass, see ApplyStencils().
+     * REQUIRES : TopologyEnd() has been called.
+     *            The counts match the mesh given to TopologyStart() and the mesh from GetMesh().
+     */
+    void FixMesh(const float *positions, int num_vertices, int stride,
+                 float *subdivided, int num_subdivided, int subdivided_stride,
+                 const AttributeStream *attributes = NULL, int num_attributes = 0);
+
+    /* FixMesh() for num_poses sets of control positions at once.
+     * positions holds the poses one after another, each num_vertices x, y, z triples stride floats apart,
+     * and subdivided receives the poses one after another, each num_subdivided triples subdivided_stride floats apart.
+     * Up to BATCH_POSES poses are interleaved per vertex, so every stencil is read once per batch
+     * and applied to all of its poses with SIMD. The results are the same as separate FixMesh() calls.
+     */
+    void FixMeshBatch(const float *positions, int num_vertices, int stride, int num_poses,
+                      float *subdivided, int num_subdivided, int subdivided_stride);
+
+    static const int BATCH_POSES = 8;
+
+    /* Updates subdivided after only the listed control vertices have moved.
+     * Only the vertices that depend on them, through any number of levels, are derived again.
+     * REQUIRES : subdivided holds the result of an earlier FixMesh() for the other positions.
+     */
+    void FixMesh(const float *positions, int num_vertices, int stride, const int *changed, int num_changed,
+                 float *subdivided, int num_subdivided, int subdivided_stride);
+
+    /* Finds the moved control vertices itself, by comparing positions with the positions of the previous FixMesh() call,
+     * see DiffPositions(). The first call after TopologyEnd() updates every vertex.
+     * REQUIRES : subdivided holds the result of the previous FixMesh().
+     */
+    void FixChangedMesh(const float *positions, int num_vertices, int stride,
+                        float *subdivided, int num_subdivided, int subdivided_stride);
+
+    /* The smooth normals of the topology mesh for positions such as the output of FixMesh(),
+     * and the tangents if texcoords and tangents are given, see VertexFaces::ComputeNormals().
+     * The faces around every vertex are listed by the first call after TopologyEnd() and reused after that.
+     * REQUIRES : TopologyEnd() has been called. Every array holds NumTopologyVertices() values.
+     */
+    void ComputeNormals(const float *positions, int stride, float *normals, int normal_stride,
+                        const float *texcoords = NULL, int texcoord_stride = 0,
+                        float *tangents = NULL, int tangent_stride = 0);
+
+    // -- Persistent topology caches.
+
+    /* Writes the compiled topology to a file, see SaveTopologyCache().
+     * The file is keyed by TopologyKey(), so it is only loaded for the same faces and the same schemes.
+     * REQUIRES : TopologyEnd() has been called.
+     */
+    void SaveTopology(const char *path);
+
+    /* Replaces TopologyStart(), the TopologySubdivide() iterations of the given schemes and TopologyEnd()
+     * with the contents of a file written by SaveTopology().
+     * Returns false if the file is missing or was written for other faces, schemes or versions,
+     * the topology must then be built as usual.
+     * A loaded topology has no winged edge mesh, so Mesh() is empty and it can not be subdivided further.
+     */
+    bool LoadTopology(const char *path, const float *positions, int num_vertices, int stride,
+                      const uint32_t *indices, int num_indices, const Scheme *schemes, int num_schemes);
+
+    // A hash of the welded faces given to TopologyStart() and of the scheme of every TopologySubdivide() iteration.
+    uint64_t TopologyKey() const { return topology_key; }
+
+    // -- In memory topology caches.
+
+    /* Adds the compiled topology to the cache. REQUIRES : TopologyEnd() has been called.
+     * The tables move into the cache entry and are read from there, so nothing is copied.
+     */
+    void StoreTopology(TopologyCache &cache);
+
+    /* Like LoadTopology(), but from a cache entry with the same TopologyKey().
+     * The tables of the entry are read in place, and the levels stay composed if they were composed when stored.
+     * Returns true at once if the current topology already has the key, false if the cache has no such entry.
+     */
+    bool RestoreTopology(TopologyCache &cache, const float *positions, int num_vertices, int stride,
+                         const uint32_t *indices, int num_indices, const Scheme *schemes, int num_schemes);
+
+    /* Makes the cached topology with the same index buffer fingerprint and num_subdivided vertices current,
+     * so the next FixMesh() uses it. Returns false if neither the current topology nor the cache has one.
+     * The current topology is kept if it matches. Otherwise throws if several cached topologies match,
+     * as the same levels of different schemes do, the overload with the schemes picks one of them.
+     * Only the control positions are kept, since FixMesh() is expected next, GetMesh() derives the others on demand.
+     */
+    bool RestoreTopology(TopologyCache &cache, const float *positions, int num_vertices, int stride,
+                         const uint32_t *indices, int num_indices, int num_subdivided);
+
+    // A hash of the raw index buffer and vertex count given to the last start, without welding.
+    uint64_t IndexFingerprint() const { return fingerprint; }
+    static uint64_t Fingerprint(int num_vertices, const uint32_t *indices, int num_indices);
+
+    /* Derives every non control vertex of data in place, see StencilTable::Apply().
+     * EVALUATE_SIMD uses the StencilEvaluator for up to 3 floats per vertex. Wider data always goes to
+     * StencilTable::Apply(), whose kernels sum the channels of a vertex in vector registers.
+     */
+    void ApplyStencils(float *data, int width, int stride);
+
+    /* Derives several streams in one pass : the streams are interleaved per vertex and evaluated with
+     * StencilTable::Apply() at their combined width, so every stencil is read once for all of them.
+     * This is the table path in either evaluation mode, see ApplyStencils(float *, int, int).
+     * REQUIRES : Every stream holds NumTopologyVertices() values, the control values already in place.
+     */
+    void ApplyStencils(const AttributeStream *streams, int num_streams);
+
+    /* Writes the subdivision operator as a sparse matrix, see StencilTable::LevelMatrix().
+     * level selects one TopologySubdivide() iteration, whose columns are the vertices before it.
+     * The default of -1 composes every level, so the columns are the control vertices, and prunes
+     * the weights of at most prune as StencilTable::Compose() does.
+     * REQUIRES : TopologyStart() has been called.
+     */
+    void GetOperator(SparseMatrix &matrix, int level = -1, float prune = 0);
+
+    // The number of recorded TopologySubdivide() iterations.
+    int NumLevels() const { return stencils.NumLevels(); }
+
+    int NumControlVertices() const { return original_vertex_count; }
+
+    /* Vertices closer than epsilon are welded by the next SubdivideStart() or TopologyStart(), see WeldVertices().
+     * 0 only welds identical positions, which is the default.
+     * Meshes with split or nearly duplicated vertices otherwise get open seams that are subdivided as boundaries.
+     */
+    void SetWeldTolerance(float epsilon);
+
+    // The welded index of every control vertex, from the last SubdivideStart() or TopologyStart().
+    const std::vector<int> &WeldMap() const { return weld_map; }
+
+    // The number of vertices FixMesh() and ApplyStencils() work on.
+    int NumTopologyVertices() const { return stencils.NumVertices(); }
+
+    void SetEvaluationMode(EvaluationMode evaluation);
+
+    // 0 uses every hardware thread, which is the default. 1 works on the calling thread.
+    void SetThreadCount(int threads);
+
+    const WingedEdge &Mesh() const { return current_WE; }
+    const StencilTable &Stencils() const { return stencils; }
+
+    // The table that FixMesh() evaluates, the composed operator if TopologyEnd() composed the levels.
+    const StencilTable &ActiveStencils() const { return composed_levels ? composed : stencils; }
+
+private:
+
+    // Builds current_WE from raw buffers.
+    void Start(const float *positions, int num_vertices, int stride,
+               const uint32_t *indices, int num_indices);
+
+    // Welds the vertices and returns the TopologyKey() that the input would get from the schemes.
+    uint64_t InputKey(const float *positions, int num_vertices, int stride,
+                      const uint32_t *indices, int num_indices, const Scheme *schemes, int num_schemes,
+                      std::vector<int> &welds) const;
+
+    // Takes the place of the compiled topology of entry, reading its tables in place.
+    // The output positions are derived from the control positions if evaluate is set, else by GetMesh().
+    void Restore(const std::shared_ptr<const TopologyCache::Entry> &entry, uint64_t print,
+                 const float *positions, int stride, bool evaluate);
+
+    // Compiles the active stencil table, dropping everything derived from the previous one.
+    void CompileStencils();
+
+    // The key of the welded faces, and the key after one more iteration of a scheme.
+    static uint64_t FacesKey(int num_vertices, const uint32_t *indices, int num_indices, const std::vector<int> &welds);
+    static uint64_t SchemeKey(uint64_t key, Scheme scheme);
+
+    // Runs one iteration of a scheme on current_WE, recording the new vertices in info unless it is NULL.
+    void SubdivideOnce(Scheme scheme, float pixel_precision, Derivations *info);
+
+    // Maps every vertex of current_WE to its index in the output mesh, -1 if it is left out.
+    // Returns the number of output vertices.
+    int OutputIndices(std::vector<int> &index_map) const;
+
+    // The number of vertices in the mesh given to SubdivideStart or TopologyStart.
+    // These vertices keep their indices in every subdivided mesh.
+    int original_vertex_count;
+
+    // Whether the output keeps vertices that are not used by any face.
+    bool all_vertices;
+
+    float weld_epsilon;
+    std::vector<int> weld_map;
+
+    uint64_t topology_key;
+    uint64_t fingerprint;
+
+    // The output mesh of a loaded or restored topology, which replaces current_WE.
+    // loaded_positions holds only the control positions while the others are left to GetMesh().
+    bool loaded_topology;
+    std::vector<float>    loaded_positions;
+    SharedArray<uint32_t> loaded_indices;
+
+    // The current windged edge structure.
+    // Its vertex indices are the indices of the vertices in the subdivided mesh.
+    WingedEdge current_WE;
+
+    // The mesh the next level is subdivided into before it takes the place of current_WE,
+    // and the temporary arrays of the subdivisions. They keep their capacity between levels and calls.
+    WingedEdge next_WE;
+    SubdivisionScratch scratch;
+
+    // The compiled derivations of every vertex in the topology subdivided mesh.
+    // Every TopologySubdivide() iteration appends one level.
+    StencilTable stencils;
+
+    // The derivations of one level are allocated here and given back at once when the next level starts.
+    Arena level_arena;
+
+    // The single level operator, used instead of stencils if composed_levels is set.
+    StencilTable composed;
+    bool  composed_levels;
+    float prune_weight;
+
+    // Recomposes the levels if stencils were recorded after the last TopologyEnd().
+    void UpdateComposition();
+
+    // The readers of every vertex of the active stencil table, built by the first incremental FixMesh().
+    StencilDependents dependents;
+    std::vector<int>  affected_rows;
+
+    // The faces around every vertex of the topology mesh, built by the first ComputeNormals().
+    VertexFaces vertex_faces;
+
+    // The interleaved poses of FixMeshBatch(), and the interleaved streams of ApplyStencils() and GetAttributes().
+    std::vector<float> batch;
+    std::vector<float> packed;
+
+    // The control values of every attribute, tightly packed.
+    std::vector<std::vector<float> > attribute_values;
+    std::vector<int> attribute_widths;
+
+    // The derivations of the batch subdivision, recorded only while there are attributes to derive.
+    StencilTable batch_stencils;
+
+    // The packed control positions of the previous FixMesh(), empty until it has been called.
+    std::vector<float> snapshot;
+    std::vector<int>   changed_vertices;
+
+    // The SIMD layout of the active stencil table, compiled by TopologyEnd().
+    StencilEvaluator evaluator;
+    EvaluationMode mode;
+
+    ThreadPool pool;
+};
+
+/* end */
+}
+#endif
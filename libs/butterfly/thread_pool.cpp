@@ -0,0 +1,167 @@
+#include <algorithm>
+#include "thread_pool.hpp"
+
+namespace gfx
+{
+
+    ThreadPool::ThreadPool(int threads) :
+        stopping(false), generation(0), busy(0), body(NULL), begin(0), end(0), chunk(1), next(0)
+    {
+        Start(threads);
+    }
+
+    ThreadPool::ThreadPool(const ThreadPool &pool) :
+        stopping(false), generation(0), busy(0), body(NULL), begin(0), end(0), chunk(1), next(0)
+    {
+        Start(pool.NumThreads());
+    }
+
+    ThreadPool &ThreadPool::operator=(const ThreadPool &pool)
+    {
+        if(this != &pool)
+        {
+            SetThreads(pool.NumThreads());
+        }
+
+        return *this;
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        Stop();
+    }
+
+    void ThreadPool::SetThreads(int threads)
+    {
+        Stop();
+        Start(threads);
+    }
+
+    void ThreadPool::Start(int threads)
+    {
+        if(threads <= 0)
+        {
+            threads = std::max(1, (int)std::thread::hardware_concurrency());
+        }
+
+        stopping = false;
+
+        for(int i = 1; i < threads; i++)
+        {
+            workers.push_back(std::thread(&ThreadPool::Work, this, generation));
+        }
+    }
+
+    void ThreadPool::Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+
+        wake.notify_all();
+
+        for(size_t i = 0; i < workers.size(); i++)
+        {
+            workers[i].join();
+        }
+
+        workers.clear();
+    }
+
+    void ThreadPool::ParallelFor(int first, int last, int grain, const LoopBody &loop)
+    {
+        int count = last - first;
+
+        if(count <= 0)
+        {
+            return;
+        }
+
+        if(workers.empty() || count <= grain)
+        {
+            loop(first, last);
+            return;
+        }
+
+        // A few chunks per thread balance uneven work without much contention on next.
+        int chunks = 4*NumThreads();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            body  = &loop;
+            begin = first;
+            end   = last;
+            chunk = std::max(std::max(grain, 1), (count + chunks - 1)/chunks);
+            next  = first;
+
+            busy = workers.size();
+            generation++;
+        }
+
+        wake.notify_all();
+
+        RunChunks();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]{ return busy == 0; });
+
+        body = NULL;
+    }
+
+    void ThreadPool::RunChunks()
+    {
+        while(true)
+        {
+            int first = next.fetch_add(chunk);
+            if(first >= end)
+            {
+                return;
+            }
+
+            (*body)(first, std::min(first + chunk, end));
+        }
+    }
+
+    void ThreadPool::Work(unsigned seen)
+    {
+        while(true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]{ return stopping || generation != seen; });
+
+                if(stopping)
+                {
+                    return;
+                }
+
+                seen = generation;
+            }
+
+            RunChunks();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                busy--;
+            }
+
+            done.notify_one();
+        }
+    }
+
+    void ParallelFor(ThreadPool *pool, int begin, int end, int grain, const LoopBody &body)
+    {
+        if(pool != NULL)
+        {
+            pool -> ParallelFor(begin, end, grain, body);
+        }
+        else if(begin < end)
+        {
+            body(begin, end);
+        }
+    }
+
+    /* end */
+}
@@ -0,0 +1,99 @@
+#ifndef __GFX_THREAD_POOL_HPP
+#define __GFX_THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gfx
+{
+
+/* A reference to the body of a parallel loop, any callable with the signature void(int first, int last).
+ * Unlike std::function it never allocates, however much the lambda captures, and it does not own the callable,
+ * which outlives the loop as every loop runs to completion before ParallelFor() returns.
+ */
+class LoopBody
+{
+public:
+    template<class Body>
+    LoopBody(const Body &body) : object(&body), call(&invoke<Body>) {}
+
+    void operator()(int first, int last) const { call(object, first, last); }
+
+private:
+    template<class Body>
+    static void invoke(const void *object, int first, int last) { (*static_cast<const Body *>(object))(first, last); }
+
+    const void *object;
+    void (*call)(const void *object, int first, int last);
+};
+
+/* A fixed set of worker threads that run parallel for loops.
+ *
+ * ParallelFor() splits a range into chunks that the workers and the calling thread take in turn,
+ * and returns once every chunk is done, which makes it a barrier between consecutive loops.
+ * Results only stay deterministic if every index writes its own outputs, which is how all of the callers use it.
+ *
+ * Loops may not be nested and a pool may only be used by one thread at a time.
+ */
+class ThreadPool
+{
+public:
+
+    // Uses threads threads including the calling one, 0 uses every hardware thread.
+    explicit ThreadPool(int threads = 0);
+
+    // Copies start their own workers with the same number of threads.
+    ThreadPool(const ThreadPool &pool);
+    ThreadPool &operator=(const ThreadPool &pool);
+
+    ~ThreadPool();
+
+    // Stops the workers and starts threads new ones.
+    void SetThreads(int threads);
+
+    // The number of threads that run a loop, including the calling one.
+    int NumThreads() const { return workers.size() + 1; }
+
+    /* Calls body(first, last) on disjoint sub ranges that cover [begin, end).
+     * Ranges shorter than grain run serially on the calling thread.
+     */
+    void ParallelFor(int begin, int end, int grain, const LoopBody &body);
+
+private:
+
+    void Start(int threads);
+    void Stop();
+
+    // Runs every loop started after the seen generation.
+    void Work(unsigned seen);
+
+    // Runs chunks of the current loop until there are none left.
+    void RunChunks();
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    bool stopping;
+    unsigned generation; // Incremented for every loop.
+    int busy;            // Workers that have not finished the current loop.
+
+    // -- The current loop.
+    const LoopBody *body;
+    int begin;
+    int end;
+    int chunk;
+    std::atomic<int> next;
+};
+
+// Runs pool -> ParallelFor(), or the whole range on the calling thread if pool is NULL.
+void ParallelFor(ThreadPool *pool, int begin, int end, int grain, const LoopBody &body);
+
+/* end */
+}
+#endif
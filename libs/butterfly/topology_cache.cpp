@@ -0,0 +1,153 @@
+#include "topology_cache.hpp"
+
+namespace gfx
+{
+
+    template <class T>
+    static size_t arrayBytes(const std::vector<T> &data)
+    {
+        return data.capacity()*sizeof(T);
+    }
+
+    // Shared values are counted too, the entry keeps them alive.
+    template <class T>
+    static size_t arrayBytes(const SharedArray<T> &data)
+    {
+        return (data.IsShared() ? data.size() : data.capacity())*sizeof(T);
+    }
+
+    static size_t tableBytes(const StencilTable &table)
+    {
+        return arrayBytes(table.offsets)
+             + arrayBytes(table.sources)
+             + arrayBytes(table.weights)
+             + arrayBytes(table.levels);
+    }
+
+    size_t TopologyCache::Entry::Bytes() const
+    {
+        return sizeof(Entry)
+             + arrayBytes(weld_map)
+             + tableBytes(stencils)
+             + tableBytes(composed)
+             + arrayBytes(indices);
+    }
+
+    TopologyCache::TopologyCache(size_t budget) :
+        budget(budget), bytes(0), hits(0), misses(0)
+    {
+    }
+
+    void TopologyCache::SetBudget(size_t limit)
+    {
+        budget = limit;
+        Evict();
+    }
+
+    void TopologyCache::Insert(const std::shared_ptr<const Entry> &entry)
+    {
+        std::unordered_map<uint64_t, EntryList::iterator>::iterator found = keys.find(entry -> key);
+
+        if(found != keys.end())
+        {
+            bytes -= (*found -> second) -> Bytes();
+            entries.erase(found -> second);
+            keys.erase(found);
+        }
+
+        size_t size = entry -> Bytes();
+
+        if(size > budget)
+        {
+            return;
+        }
+
+        entries.push_front(entry);
+
+        keys[entry -> key] = entries.begin();
+        bytes += size;
+
+        Evict();
+    }
+
+    std::shared_ptr<const TopologyCache::Entry> TopologyCache::Find(uint64_t key)
+    {
+        std::unordered_map<uint64_t, EntryList::iterator>::iterator found = keys.find(key);
+
+        if(found == keys.end())
+        {
+            misses++;
+            return std::shared_ptr<const Entry>();
+        }
+
+        hits++;
+        entries.splice(entries.begin(), entries, found -> second);
+        return entries.front();
+    }
+
+    std::shared_ptr<const TopologyCache::Entry> TopologyCache::Find(uint64_t fingerprint, int num_vertices)
+    {
+        EntryList::iterator match = entries.end();
+
+        for(EntryList::iterator entry = entries.begin(); entry != entries.end(); ++entry)
+        {
+            if((*entry) -> fingerprint != fingerprint || (*entry) -> stencils.NumVertices() != num_vertices)
+            {
+                continue;
+            }
+
+            // An ambiguous match is a miss, rather than a guess at the scheme.
+            if(match != entries.end())
+            {
+                misses++;
+                return std::shared_ptr<const Entry>();
+            }
+
+            match = entry;
+        }
+
+        if(match == entries.end())
+        {
+            misses++;
+            return std::shared_ptr<const Entry>();
+        }
+
+        hits++;
+        entries.splice(entries.begin(), entries, match);
+        return entries.front();
+    }
+
+    int TopologyCache::Count(uint64_t fingerprint, int num_vertices) const
+    {
+        int count = 0;
+
+        for(EntryList::const_iterator entry = entries.begin(); entry != entries.end(); ++entry)
+        {
+            if((*entry) -> fingerprint == fingerprint && (*entry) -> stencils.NumVertices() == num_vertices)
+            {
+                count++;
+            }
+        }
+
+        return count;
+    }
+
+    void TopologyCache::Clear()
+    {
+        entries.clear();
+        keys.clear();
+        bytes = 0;
+    }
+
+    void TopologyCache::Evict()
+    {
+        while(bytes > budget && !entries.empty())
+        {
+            bytes -= entries.back() -> Bytes();
+            keys.erase(entries.back() -> key);
+            entries.pop_back();
+        }
+    }
+
+    /* end */
+}
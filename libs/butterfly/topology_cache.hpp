@@ -0,0 +1,93 @@
+#ifndef __GFX_TOPOLOGY_CACHE_HPP
+#define __GFX_TOPOLOGY_CACHE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "shared_array.hpp"
+#include "stencil.hpp"
+
+namespace gfx
+{
+
+/* Compiled topologies kept in memory, so a Subdivider can switch between several meshes without subdividing again.
+ *
+ * Entries are keyed by Subdivider::TopologyKey(), and can also be found by the fingerprint of their index buffer.
+ * The cache is bounded by a byte budget, the least recently used entries are evicted first.
+ * Entries are never changed once added, so a Subdivider reads the tables of its current entry in place,
+ * and keeps the entry alive after it has been evicted.
+ */
+class TopologyCache
+{
+public:
+    struct Entry
+    {
+        uint64_t key;
+        uint64_t fingerprint;
+
+        std::vector<int>      weld_map;
+        StencilTable          stencils;
+        SharedArray<uint32_t> indices;
+
+        // The composed operator and the arguments of TopologyEnd(), composed is empty unless compose is set.
+        StencilTable composed;
+        bool  compose;
+        float prune;
+
+        Entry() : key(0), fingerprint(0), compose(false), prune(0) {}
+
+        size_t Bytes() const;
+    };
+
+    // The cache keeps nothing until it is given a budget.
+    explicit TopologyCache(size_t budget = 0);
+
+    // Evicts entries until the cache fits into the budget.
+    void SetBudget(size_t bytes);
+
+    // Adds the entry, replacing any entry with the same key. Entries larger than the whole budget are not kept.
+    void Insert(const std::shared_ptr<const Entry> &entry);
+
+    // The entry with the key, or NULL. Found entries become the most recently used.
+    std::shared_ptr<const Entry> Find(uint64_t key);
+
+    /* The only entry with the index buffer fingerprint and num_vertices subdivided vertices.
+     * NULL if there is none, or if several entries match, since schemes with the same vertex counts can not be told apart.
+     * The entries are searched in order, caches are expected to hold a few topologies.
+     */
+    std::shared_ptr<const Entry> Find(uint64_t fingerprint, int num_vertices);
+
+    // The number of entries that Find(fingerprint, num_vertices) chooses from, without touching the recent use order.
+    int Count(uint64_t fingerprint, int num_vertices) const;
+
+    void Clear();
+
+    size_t Budget() const { return budget; }
+    size_t Bytes() const { return bytes; }
+    int    Size() const { return entries.size(); }
+
+    // The lookups that found or missed an entry.
+    size_t Hits() const { return hits; }
+    size_t Misses() const { return misses; }
+
+private:
+    void Evict();
+
+    // Ordered from the most to the least recently used.
+    typedef std::list<std::shared_ptr<const Entry> > EntryList;
+
+    EntryList entries;
+    std::unordered_map<uint64_t, EntryList::iterator> keys;
+
+    size_t budget;
+    size_t bytes;
+    size_t hits;
+    size_t misses;
+};
+
+/* end */
+}
+#endif
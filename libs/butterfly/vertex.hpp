@@ -1,28 +1,23 @@
 #ifndef __GFX_VERTEX_HPP
 #define __GFX_VERTEX_HPP
 #include <iostream>
-#ifdef __APPLE__
-#include <OpenGL/gl.h>
-#else
-#include <GL/gl.h>
-#endif
 
 namespace gfx
 {
 
 class Vertex
 {
-  GLfloat x;
-  GLfloat y;
-  GLfloat z;
+  float x;
+  float y;
+  float z;
 
 public:
   Vertex() {}
-  Vertex(GLfloat x, GLfloat y, GLfloat z) : x(x), y(y), z(z) {}
+  Vertex(float x, float y, float z) : x(x), y(y), z(z) {}
 
-  GLfloat X() const { return x; }
-  GLfloat Y() const { return y; }
-  GLfloat Z() const { return z; }
+  float X() const { return x; }
+  float Y() const { return y; }
+  float Z() const { return z; }
 
   /* used to use Vertex as key in a map */
   bool operator<(const Vertex& v) const
@@ -52,22 +47,22 @@ public:
 
   /* arithmitic operators */
 
-  friend Vertex operator/(const Vertex& v, GLfloat f)
+  friend Vertex operator/(const Vertex& v, float f)
   {
     return Vertex(v.X()/f, v.Y()/f, v.Z()/f);
   }
 
-  friend Vertex operator*(const Vertex& v, GLfloat f)
+  friend Vertex operator*(const Vertex& v, float f)
   {
     return Vertex(v.X()*f, v.Y()*f, v.Z()*f);
   }
 
-  friend Vertex operator+(const Vertex& v, GLfloat f)
+  friend Vertex operator+(const Vertex& v, float f)
   {
     return Vertex(v.X()+f, v.Y()+f, v.Z()+f);
   }
 
-  friend Vertex operator-(const Vertex& v, GLfloat f)
+  friend Vertex operator-(const Vertex& v, float f)
   {
     return Vertex(v.X()-f, v.Y()-f, v.Z()-f);
   }
@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include "weld.hpp"
+#include "profile.hpp"
+
+namespace gfx
+{
+
+    // The integer coordinates of a grid cell.
+    struct Cell
+    {
+        long long x, y, z;
+
+        bool operator==(const Cell &c) const { return x == c.x && y == c.y && z == c.z; }
+    };
+
+    struct CellHash
+    {
+        size_t operator()(const Cell &c) const
+        {
+            return (size_t)(c.x*73856093LL ^ c.y*19349663LL ^ c.z*83492791LL);
+        }
+    };
+
+    // Welds identical positions. A stable sort puts the lowest index of every position first.
+    static int weldExact(const float *positions, int num_vertices, int stride, std::vector<int> &remap)
+    {
+        std::vector<int> order(num_vertices);
+        for(int i = 0; i < num_vertices; i++)
+        {
+            order[i] = i;
+        }
+
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+        {
+            const float *p = positions + a*stride;
+            const float *q = positions + b*stride;
+            return std::lexicographical_compare(p, p + 3, q, q + 3);
+        });
+
+        int distinct = 0;
+        for(int k = 0; k < num_vertices; k++)
+        {
+            const float *p = positions + order[k]*stride;
+            const float *q = k > 0 ? positions + order[k - 1]*stride : NULL;
+
+            if(q != NULL && p[0] == q[0] && p[1] == q[1] && p[2] == q[2])
+            {
+                remap[order[k]] = remap[order[k - 1]];
+                continue;
+            }
+
+            remap[order[k]] = order[k];
+            distinct++;
+        }
+
+        return distinct;
+    }
+
+    int WeldVertices(const float *positions, int num_vertices, int stride, float epsilon, std::vector<int> &remap)
+    {
+        GFX_PROFILE_SCOPE("weld");
+
+        remap.resize(num_vertices);
+
+        if(epsilon <= 0)
+        {
+            return weldExact(positions, num_vertices, stride, remap);
+        }
+
+        // Cells are 2 epsilon wide, so the vertices within epsilon of a point lie in the 2 x 2 x 2 cells on its nearer sides.
+        double inverse = 0.5/epsilon;
+        float  sqr_epsilon = epsilon*epsilon;
+
+        // The first distinct vertex of every cell, later ones are linked through next.
+        std::unordered_map<Cell, int, CellHash> cells;
+        cells.reserve(num_vertices);
+        std::vector<int> next(num_vertices, -1);
+
+        int distinct = 0;
+        for(int i = 0; i < num_vertices; i++)
+        {
+            const float *p = positions + i*stride;
+
+            double x = p[0]*inverse;
+            double y = p[1]*inverse;
+            double z = p[2]*inverse;
+
+            Cell cell = {(long long)std::floor(x), (long long)std::floor(y), (long long)std::floor(z)};
+
+            // The direction of the nearer neighbour cell along every axis.
+            int sx = x - cell.x < 0.5 ? -1 : 1;
+            int sy = y - cell.y < 0.5 ? -1 : 1;
+            int sz = z - cell.z < 0.5 ? -1 : 1;
+
+            // -- Look for the lowest distinct vertex within epsilon.
+            int match = -1;
+
+            for(int n = 0; n < 8; n++)
+            {
+                Cell neighbor = {cell.x + ((n & 1) ? sx : 0),
+                                 cell.y + ((n & 2) ? sy : 0),
+                                 cell.z + ((n & 4) ? sz : 0)};
+
+                std::unordered_map<Cell, int, CellHash>::const_iterator found = cells.find(neighbor);
+
+                for(int j = found == cells.end() ? -1 : found -> second; j != -1; j = next[j])
+                {
+                    if(match != -1 && j > match)
+                    {
+                        continue;
+                    }
+
+                    const float *q = positions + j*stride;
+                    float dx = p[0] - q[0];
+                    float dy = p[1] - q[1];
+                    float dz = p[2] - q[2];
+
+                    if(dx*dx + dy*dy + dz*dz <= sqr_epsilon)
+                    {
+                        match = j;
+                    }
+                }
+            }
+
+            if(match != -1)
+            {
+                remap[i] = match;
+                continue;
+            }
+
+            // -- A new distinct vertex, link it into its cell.
+            remap[i] = i;
+            distinct++;
+
+            std::pair<std::unordered_map<Cell, int, CellHash>::iterator, bool> slot = cells.insert(std::make_pair(cell, i));
+            if(!slot.second)
+            {
+                next[i] = slot.first -> second;
+                slot.first -> second = i;
+            }
+        }
+
+        return distinct;
+    }
+
+    /* end */
+}
@@ -0,0 +1,23 @@
+#ifndef __GFX_WELD_HPP
+#define __GFX_WELD_HPP
+
+#include <vector>
+
+namespace gfx
+{
+
+/* Finds the vertices that should be treated as one.
+ * positions holds num_vertices x, y, z triples, stride floats apart.
+ *
+ * With epsilon <= 0 only identical positions are welded.
+ * Otherwise every vertex is welded to the lowest earlier vertex within epsilon of it, found through a hashed uniform grid,
+ * so the pass runs in expected linear time. Chains of close vertices are welded greedily in index order.
+ *
+ * ENSURES : remap[i] is the lowest index of the vertices welded with i, remap[remap[i]] == remap[i].
+ *           Returns the number of distinct vertices.
+ */
+int WeldVertices(const float *positions, int num_vertices, int stride, float epsilon, std::vector<int> &remap);
+
+/* end */
+}
+#endif
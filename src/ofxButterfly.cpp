@@ -6,175 +6,105 @@
  *
  */
 
+#include <algorithm>
 #include "ofxButterfly.h"
 #include "error.hpp"
+#include "profile.hpp"
 
 
-// Transforms an ofMesh to a gfx:: WindgedEdge.
-// ENSURES : The index orderings should not have been changed.
-gfx::WingedEdge toWingedEdge(ofMesh mesh, std::map<gfx::Vertex, int> &map_vip, std::map<int, gfx::Vertex> &map_ivp)
+// The ofMesh indices as uint32_t, copied only if ofIndexType is narrower.
+static const uint32_t *wideIndices(const ofMesh &mesh, std::vector<uint32_t> &copy)
 {
+    const ofIndexType *indices = mesh.getIndexPointer();
     
-    gfx::WingedEdge WE_Output;
-    
-    // -- Extract and add all of the vertices.
-    ofVec3f* vertices = mesh.getVerticesPointer();
-    int len_vertices  = mesh.getNumVertices();
-    
-    std::vector<gfx::Vertex> dataVertices;
-    
-    for(int i = 0; i < len_vertices; i++)
-    {
-        ofVec3f& vert = vertices[i];
-        gfx::Vertex dataVert = WE_Output.AddVertex(vert.x, vert.y, vert.z);
-        
-        dataVertices.push_back(dataVert);
-        map_vip.insert(std::pair<gfx::Vertex, int>(dataVert, i));
-        map_ivp.insert(std::pair<int, gfx::Vertex>(i, dataVert));
-    }
-    
-    // Construct the tripartite relationship (Add the triangular faces.)
-    ofIndexType * indexes = mesh.getIndexPointer();
-    int len_indexes       = mesh.getNumIndices();
-    
-    for(int i = 0; i < len_indexes; i+=3)
+    if(sizeof(ofIndexType) == sizeof(uint32_t))
     {
-        ofIndexType i1, i2, i3;
-        
-        i1 = indexes[i + 0];
-        i2 = indexes[i + 1];
-        i3 = indexes[i + 2];
-        
-        gfx::Vertex v1, v2, v3;
-        
-        v1 = dataVertices[i1];
-        v2 = dataVertices[i2];
-        v3 = dataVertices[i3];
-        
-        gfx::Edge e1, e2, e3;
-        
-        e1 = WE_Output.AddEdge(v1, v2);
-        e2 = WE_Output.AddEdge(v2, v3);
-        e3 = WE_Output.AddEdge(v3, v1);
-        
-        WE_Output.AddFace(e1, e2, e3);
+        return (const uint32_t *)indices;
     }
     
-    return WE_Output;
+    copy.assign(indices, indices + mesh.getNumIndices());
+    return copy.empty() ? NULL : &copy[0];
+}
+
+// The ofMesh positions as x, y, z float triples.
+static const float *meshPositions(const ofMesh &mesh)
+{
+    return mesh.getNumVertices() == 0 ? NULL : &mesh.getVerticesPointer()[0].x;
+}
+
+static const int VEC3_STRIDE = sizeof(ofVec3f)/sizeof(float);
+static const int VEC2_STRIDE = sizeof(ofVec2f)/sizeof(float);
+static const int COLOR_STRIDE = sizeof(ofFloatColor)/sizeof(float);
+
+static gfx::AttributeStream texCoordStream(std::vector<ofVec2f> &coords)
+{
+    gfx::AttributeStream stream = {&coords[0].x, 2, VEC2_STRIDE};
+    return stream;
+}
+
+static gfx::AttributeStream colorStream(std::vector<ofFloatColor> &colors)
+{
+    gfx::AttributeStream stream = {&colors[0].r, 4, COLOR_STRIDE};
+    return stream;
 }
 
-// Converts from a gfx::WingedEdge class to an ofMesh.
-// ENSURES : The indices of the original vertices have not been mutated.
-ofMesh fromWingedEdge(gfx::WingedEdge WE, std::map<gfx::Vertex, int> &index_map, std::map<int, gfx::Vertex> &map_iv)
+// Converts the current mesh of the core to an ofMesh.
+// The vertex and index buffers are sized exactly and written in place,
+// along with the texture coordinates and colors if they are registered attributes of the core.
+static ofMesh toOfMesh(gfx::Subdivider &core, int texcoord_attribute, int color_attribute)
 {
+    GFX_PROFILE_SCOPE("to_of_mesh");
     
     ofMesh output;
     
-    // Extract useful data from the Winged edge structure.
-    std::map<gfx::Vertex, std::set<gfx::Edge> > vertMap = WE.vertexList;
-    std::map<gfx::Edge, gfx::EdgeList> edgeListMap 		= WE.edgeListMap;
-    std::map<gfx::Face, std::set<gfx::Edge> > faceMap   = WE.faceList;
+    int num_vertices, num_indices;
+    core.GetMeshSize(num_vertices, num_indices);
     
-    // We need to compute the vertices, and the list of triangular
-    // faces in the subdivision to reconstruct an ofMesh.
+    std::vector<ofVec3f> &vertices = output.getVertices();
+    std::vector<ofIndexType> &indices = output.getIndices();
     
-    int len = map_iv.size();
+    vertices.resize(num_vertices);
+    indices.resize(num_indices);
     
-    // Add the original vertices to the new ofMesh.
-    for(int i = 0; i < len; i++)
+    float *vertex_data = num_vertices == 0 ? NULL : &vertices[0].x;
+    
+    if(sizeof(ofIndexType) == sizeof(uint32_t))
     {
-        gfx::Vertex v = map_iv.find(i) -> second;
-        ofVec3f ofVector(v.X(), v.Y(), v.Z());
-        output.addVertex(ofVector);
+        core.GetMesh(vertex_data, VEC3_STRIDE, num_indices == 0 ? NULL : (uint32_t *)&indices[0]);
     }
-    
-    // Add the new vertices to the ofMesh and add them to the index_map;
-    for(std::map<gfx::Vertex, std::set<gfx::Edge> >::iterator iter = vertMap.begin(); iter != vertMap.end(); ++iter)
+    else
     {
-        gfx::Vertex v = iter -> first;
-        
-        // Avoid reproccessing the original vertices that have already been added to the mesh.
-        if(index_map.find(v) != index_map.end())
-        {
-            continue;
-        }
-        
-        ofVec3f ofVector(v.X(), v.Y(), v.Z());
-        output.addVertex(ofVector);
-            
-        // The next index will always be equal to the length.
-        index_map[v] = len;
-        len++;
+        std::vector<uint32_t> wide(num_indices);
+        core.GetMesh(vertex_data, VEC3_STRIDE, num_indices == 0 ? NULL : &wide[0]);
+        std::copy(wide.begin(), wide.end(), indices.begin());
     }
     
-    
-    // We are going to sort the triangles by lowest indice in linear time.
-    // This allows the triangles associated with lower indices to be added to the mesh before those with higher indices,
-    // which allows for the arbitrary depth ordering of the triangles to more closely match the mesh builder's artistic
-    // intent.
-    
-    // -- initialize the triangle sorting data structure.
-    std::map<int, std::vector<std::vector<int> > > triangles;
-    
-    for(int i = 0; i < len; i++)
+    if(num_vertices == 0 || core.NumAttributes() == 0)
     {
-        std::vector< std::vector<int> > vec;
-        triangles[i] = vec;
+        return output;
     }
     
-    // Add each triangle to the structure.
-    for(std::map<gfx::Face, std::set<gfx::Edge> >::iterator iter = faceMap.begin(); iter != faceMap.end(); ++iter)
+    // -- Derive the attributes, all in the same pass.
+    std::vector<gfx::AttributeStream> attributes(core.NumAttributes());
+    
+    if(texcoord_attribute != -1)
     {
-        gfx::Face f = iter -> first;
-        
-        // Extract vertice information from the face.
-        gfx::Edge e1 = f.E1();
-        gfx::Edge e2 = f.E2();
-        gfx::Vertex v1, v2, v3;
-        
-        v1 = e1.V1();
-        v2 = e1.V2();
-        v3 = e2.V1();
-        
-        // FIXME : Make sure this is a vector equality comparison, not a pointer comparison.
-        if(v3 == v1 || v3 == v2)
-        {
-            v3 = e2.V2();
-        }
-        
-        // Translate these vertices into ofMesh indices.
-        int i1, i2, i3;
-        i1 = index_map.find(v1) -> second;
-        i2 = index_map.find(v2) -> second;
-        i3 = index_map.find(v3) -> second;
-        
-        int min = MIN(MIN(i1, i2), i3);
-        
-        std::vector<int> indices;
-        indices.push_back(i1);
-        indices.push_back(i2);
-        indices.push_back(i3);
-        
-        triangles[min].push_back(indices);
+        output.getTexCoords().resize(num_vertices);
+        attributes[texcoord_attribute] = texCoordStream(output.getTexCoords());
     }
     
-    // Using the sorting structure,
-    // Add all of the triangles to the output mesh in sorted order by minimum index and triangle order.
-    for(int i = 0; i < len; i++)
+    if(color_attribute != -1)
     {
-        std::vector< std::vector<int> > vec_list = triangles[i];
-        for(auto iter = vec_list.begin(); iter != vec_list.end(); ++iter)
-        {
-            output.addIndex((*iter)[0]);
-            output.addIndex((*iter)[1]);
-            output.addIndex((*iter)[2]);
-        }
+        output.getColors().resize(num_vertices);
+        attributes[color_attribute] = colorStream(output.getColors());
     }
     
+    core.GetAttributes(&attributes[0]);
+    
     return output;
 }
 
-ofxButterfly::ofxButterfly()
+ofxButterfly::ofxButterfly() : texcoord_attribute(-1), color_attribute(-1)
 {
 	// TODO Auto-generated constructor stub
 }
@@ -194,6 +124,8 @@ ofxButterfly::~ofxButterfly()
 // -- Single mesh subdivision functions.
 ofMesh ofxButterfly::subdivideButterfly(ofMesh &mesh, int iterations)
 {
+    GFX_PROFILE_SCOPE("subdivideButterfly");
+    
     subdivide_start(mesh);
     subdivideButterfly(iterations);
     return subdivide_end();
@@ -201,6 +133,8 @@ ofMesh ofxButterfly::subdivideButterfly(ofMesh &mesh, int iterations)
 
 ofMesh ofxButterfly::subdivideLinear(ofMesh &mesh, int iterations)
 {
+    GFX_PROFILE_SCOPE("subdivideLinear");
+    
     subdivide_start(mesh);
     subdivideLinear(iterations);
     return subdivide_end();
@@ -208,6 +142,8 @@ ofMesh ofxButterfly::subdivideLinear(ofMesh &mesh, int iterations)
 
 ofMesh ofxButterfly::subdividePascal(ofMesh &mesh, int iterations)
 {
+    GFX_PROFILE_SCOPE("subdividePascal");
+    
     subdivide_start(mesh);
     subdividePascal(iterations);
     return subdivide_end();
@@ -215,66 +151,120 @@ ofMesh ofxButterfly::subdividePascal(ofMesh &mesh, int iterations)
 
 ofMesh ofxButterfly::subdivideBoundary(ofMesh &mesh, float pixel_prescision, int iterations)
 {
+    GFX_PROFILE_SCOPE("subdivideBoundary");
+    
     subdivide_start(mesh);
     subdivideBoundary(pixel_prescision, iterations);
     return subdivide_end();
 }
 
+ofMesh ofxButterfly::subdivideAdaptive(ofMesh &mesh, float tolerance, int iterations,
+                                       int max_triangles, float max_edge_length)
+{
+    GFX_PROFILE_SCOPE("subdivideAdaptive");
+    
+    subdivide_start(mesh);
+    subdivideAdaptive(tolerance, iterations, max_triangles, max_edge_length);
+    return subdivide_end();
+}
+
+ofMesh ofxButterfly::refineBoundary(ofMesh &mesh, float pixel_prescision, int max_vertices)
+{
+    GFX_PROFILE_SCOPE("refineBoundary");
+    
+    subdivide_start(mesh);
+    refineBoundary(pixel_prescision, max_vertices);
+    return subdivide_end();
+}
+
 
 // -- Batch subdivision pipeline.
 
 // Prepares the given mesh for subdivision.
 void ofxButterfly::subdivide_start(ofMesh &mesh)
 {
-    map_vertice_index.clear();
-    map_index_vertice.clear();
-    current_WE = toWingedEdge(mesh, map_vertice_index, map_index_vertice);
+    std::vector<uint32_t> copy;
+    core.SubdivideStart(meshPositions(mesh), mesh.getNumVertices(), VEC3_STRIDE,
+                        wideIndices(mesh, copy), mesh.getNumIndices());
+    addAttributes(mesh);
+}
+
+void ofxButterfly::subdivide_start(const float *positions, int num_vertices, int stride,
+                                   const uint32_t *indices, int num_indices)
+{
+    core.SubdivideStart(positions, num_vertices, stride, indices, num_indices);
+    texcoord_attribute = color_attribute = -1;
+}
+
+void ofxButterfly::subdivideButterfly(int iterations)
+{
+    core.Subdivide(gfx::Subdivider::BUTTERFLY, iterations);
+}
+
+void ofxButterfly::subdivideLinear(int iterations)
+{
+    core.Subdivide(gfx::Subdivider::LINEAR, iterations);
 }
 
-inline void ofxButterfly::subdivideButterfly(int iterations)
+void ofxButterfly::subdividePascal(int iterations)
 {
-    subdivide(iterations, BUTTERFLY);
+    core.Subdivide(gfx::Subdivider::PASCAL, iterations);
 }
 
-inline void ofxButterfly::subdivideLinear(int iterations)
+void ofxButterfly::subdivideBoundary(float pixel_prescision, int iterations)
 {
-    subdivide(iterations, LINEAR);
+    core.Subdivide(gfx::Subdivider::BOUNDARY, iterations, pixel_prescision);
 }
 
-inline void ofxButterfly::subdividePascal(int iterations)
+void ofxButterfly::subdivideAdaptive(float tolerance, int iterations, int max_triangles, float max_edge_length)
 {
-    subdivide(iterations, PASCAL);
+    core.SubdivideAdaptive(tolerance, iterations, max_triangles, max_edge_length);
 }
 
-inline void ofxButterfly::subdivideBoundary(float pixel_prescision, int iterations)
+void ofxButterfly::refineBoundary(float pixel_prescision, int max_vertices)
 {
-    subdivide(iterations, BOUNDARY, pixel_prescision);
+    core.RefineBoundary(pixel_prescision, max_vertices);
 }
 
-inline ofMesh ofxButterfly::subdivide_end()
+ofMesh ofxButterfly::subdivide_end()
 {
     // Extract the subdivided mesh.
-    ofMesh output = fromWingedEdge(current_WE, map_vertice_index, map_index_vertice);
-    return output;
+    return toOfMesh(core, texcoord_attribute, color_attribute);
 }
 
 // Fast repetitive subdivision routines.
 void ofxButterfly::topology_start(ofMesh &mesh)
 {
-    map_vertice_index.clear();
-    map_index_vertice.clear();
+    std::vector<uint32_t> copy;
+    core.TopologyStart(meshPositions(mesh), mesh.getNumVertices(), VEC3_STRIDE,
+                       wideIndices(mesh, copy), mesh.getNumIndices());
+    addAttributes(mesh);
+}
+
+void ofxButterfly::topology_start(const float *positions, int num_vertices, int stride,
+                                  const uint32_t *indices, int num_indices)
+{
+    core.TopologyStart(positions, num_vertices, stride, indices, num_indices);
+    texcoord_attribute = color_attribute = -1;
+}
+
+// Registers the texture coordinates and colors of the mesh with the core, if every vertex has one.
+void ofxButterfly::addAttributes(ofMesh &mesh)
+{
+    core.ClearAttributes();
+    texcoord_attribute = color_attribute = -1;
+    
+    int num_vertices = mesh.getNumVertices();
     
-    // -- Initialize the transformation mapping.
-    transformation.clear();
-    int len = mesh.getNumVertices();
-    for(int i = 0; i < len; i++)
+    if(num_vertices > 0 && mesh.getNumTexCoords() == num_vertices)
     {
-        vector<int> val;
-        val.push_back(i);
-        transformation[i] = val;
+        texcoord_attribute = core.AddAttribute(&mesh.getTexCoordsPointer()[0].x, 2, VEC2_STRIDE);
     }
     
-    current_WE = toWingedEdge(mesh, map_vertice_index, map_index_vertice);
+    if(num_vertices > 0 && mesh.getNumColors() == num_vertices)
+    {
+        color_attribute = core.AddAttribute(&mesh.getColorsPointer()[0].r, 4, COLOR_STRIDE);
+    }
 }
 
 /*
@@ -285,291 +275,269 @@ void ofxButterfly::topology_start(ofMesh &mesh)
 
 void ofxButterfly::topology_subdivide_boundary(int iterations)
 {
-    for(int i = 0; i < iterations; i++)
-    {
-        topology_subdivide(BOUNDARY);
-    }
+    core.TopologySubdivide(gfx::Subdivider::BOUNDARY, iterations);
 }
 
 
 void ofxButterfly::topology_subdivide_pascal(int iterations)
 {
-    for(int i = 0; i < iterations; i++)
-    {
-        topology_subdivide(PASCAL);
-    }
+    core.TopologySubdivide(gfx::Subdivider::PASCAL, iterations);
 }
 
 void ofxButterfly::topology_subdivide_linear(int iterations)
 {
-    for(int i = 0; i < iterations; i++)
+    core.TopologySubdivide(gfx::Subdivider::LINEAR, iterations);
+}
+
+void ofxButterfly::topology_subdivide_butterfly(int iterations)
+{
+    core.TopologySubdivide(gfx::Subdivider::BUTTERFLY, iterations);
+}
+
+ofMesh ofxButterfly::topology_end(bool compose, float prune)
+{
+    GFX_PROFILE_SCOPE("topology_end");
+    
+    core.TopologyEnd(compose, prune);
+    
+    if(topologies.Budget() > 0)
     {
-        topology_subdivide(LINEAR);
+        core.StoreTopology(topologies);
     }
+    
+    // Every vertex is kept, since later vertices may be derived from vertices that are no longer in a face.
+    return toOfMesh(core, texcoord_attribute, color_attribute);
 }
 
-void ofxButterfly::topology_subdivide_butterfly(int iterations)
+
+void ofxButterfly::topology_save(const std::string &path)
+{
+    core.SaveTopology(path.c_str());
+}
+
+bool ofxButterfly::topology_load(const std::string &path, ofMesh &mesh,
+                                 const std::vector<gfx::Subdivider::Scheme> &schemes, ofMesh &subdivided_mesh)
 {
-    for(int i = 0; i < iterations; i++)
+    std::vector<uint32_t> copy;
+    
+    if(!core.LoadTopology(path.c_str(), meshPositions(mesh), mesh.getNumVertices(), VEC3_STRIDE,
+                          wideIndices(mesh, copy), mesh.getNumIndices(),
+                          schemes.empty() ? NULL : &schemes[0], schemes.size()))
     {
-        topology_subdivide(BUTTERFLY);
+        return false;
     }
+    
+    addAttributes(mesh);
+    subdivided_mesh = toOfMesh(core, texcoord_attribute, color_attribute);
+    return true;
 }
 
-// Private main work routine for caching derivation information.
-void ofxButterfly::topology_subdivide(subdivision_type type)
+bool ofxButterfly::topology_cached(ofMesh &mesh, const std::vector<gfx::Subdivider::Scheme> &schemes,
+                                   ofMesh &subdivided_mesh)
 {
-    std::map<gfx::Vertex, std::vector<gfx::Vertex> > info;
+    std::vector<uint32_t> copy;
     
-    // -- Subdivide every boundary vertice.
-    switch(type)
+    if(!core.RestoreTopology(topologies, meshPositions(mesh), mesh.getNumVertices(), VEC3_STRIDE,
+                             wideIndices(mesh, copy), mesh.getNumIndices(),
+                             schemes.empty() ? NULL : &schemes[0], schemes.size()))
     {
-        case BUTTERFLY:
-            current_WE = current_WE.ButterflySubdivide(info);
-            break;
-        case BOUNDARY:
-            current_WE = current_WE.BoundaryTrianglularSubdivide(info);
-            break;
-        case PASCAL:
-            current_WE = current_WE.SillyPascalSubdivide(info);
-            break;
-        case LINEAR:
-            current_WE = current_WE.LinearSubdivide(info);
-            break;
+        return false;
     }
     
-    // Update the transformation.
-    int next_index = transformation.size();
-    for(auto iter = current_WE.vertexList.begin(); iter != current_WE.vertexList.end(); ++iter)
+    addAttributes(mesh);
+    subdivided_mesh = toOfMesh(core, texcoord_attribute, color_attribute);
+    return true;
+}
+
+void ofxButterfly::fixMeshCached(ofMesh &mesh, ofMesh &subdivided_mesh)
+{
+    std::vector<uint32_t> copy;
+    
+    if(!core.RestoreTopology(topologies, meshPositions(mesh), mesh.getNumVertices(), VEC3_STRIDE,
+                             wideIndices(mesh, copy), mesh.getNumIndices(), subdivided_mesh.getNumVertices()))
     {
-        gfx::Vertex v = iter -> first;
-        
-        // If the vertice is old, just continue.
-        if(map_vertice_index.find(v) != map_vertice_index.end())
-        {
-            continue;
-        }
-        
-        // The vertice is new.
-        map_vertice_index[v] = next_index;
-        map_index_vertice[next_index] = v;
-        
-        // -- Convert the vertex_derivation to an indice derivation.
-        // note: that all vertices/indexes in the derivation must be old, becuase of the subdivision algorithm.
-        std::vector<gfx::Vertex> vertex_derivation = info.find(v)->second;
-        std::vector<int> indice_derivation;
-        
-        for(auto iter = vertex_derivation.begin(); iter != vertex_derivation.end(); ++iter)
-        {
-            indice_derivation.push_back(map_vertice_index[*iter]);
-        }
-        
-        transformation[next_index] = indice_derivation;
-        
-        next_index++;
+        throw RuntimeError("fixMesh Error: No cached topology matches the meshes.");
     }
-   
+    
+    fixMesh(mesh, subdivided_mesh);
 }
 
-ofMesh ofxButterfly::topology_end()
+void ofxButterfly::setTopologyCacheBudget(size_t bytes)
 {
-    return subdivide_end();
+    topologies.SetBudget(bytes);
 }
 
+const gfx::TopologyCache &ofxButterfly::getTopologyCache() const
+{
+    return topologies;
+}
 
 void ofxButterfly::fixMesh(ofMesh &mesh, ofMesh &subdivided_mesh)
 {
-    vector<ofVec3f> original_vertices = mesh.getVertices();
-    ofVec3f * sub_vertices = subdivided_mesh.getVerticesPointer();
+    GFX_PROFILE_SCOPE("fixMesh");
+    
+    int original_vert_num = mesh.getNumVertices();
+    int full_subdivided_num = subdivided_mesh.getNumVertices();
+    
+    // -- The texture coordinates and colors that the user has defined are derived along with the vertices.
+    std::vector<gfx::AttributeStream> attributes;
     
-    int original_vert_num = original_vertices.size();
+    int original_texture_num = mesh.getNumTexCoords();
+    int original_color_num   = mesh.getNumColors();
     
-    // Move all of the original vertices to the divided mesh.
-    for(int i = 0; i < original_vert_num; i++)
+    if(full_subdivided_num > 0 && original_texture_num > 0)
     {
-        sub_vertices[i] = original_vertices[i];
+        // Make sure we have a texture coordinate for every vertice in the mesh.
+        for(int i = subdivided_mesh.getNumTexCoords(); i < full_subdivided_num; i++)
+        {
+            subdivided_mesh.addTexCoord(subdivided_mesh.getVertex(i));
+        }
+        
+        // Map all original texture coordinates to the subdivided mesh.
+        std::vector<ofVec2f> &coords = subdivided_mesh.getTexCoords();
+        std::copy(mesh.getTexCoordsPointer(), mesh.getTexCoordsPointer() + std::min(original_texture_num, original_vert_num),
+                  coords.begin());
+        
+        attributes.push_back(texCoordStream(coords));
     }
-
-    deriveVertices(original_vert_num, sub_vertices, subdivided_mesh.getNumVertices());
     
+    if(full_subdivided_num > 0 && original_color_num > 0)
+    {
+        std::vector<ofFloatColor> &colors = subdivided_mesh.getColors();
+        colors.resize(full_subdivided_num, ofFloatColor(1, 1, 1, 1));
+        std::copy(mesh.getColorsPointer(), mesh.getColorsPointer() + std::min(original_color_num, original_vert_num),
+                  colors.begin());
+        
+        attributes.push_back(colorStream(colors));
+    }
     
-    // --  handle texture coordinates.
+    core.FixMesh(meshPositions(mesh), original_vert_num, VEC3_STRIDE,
+                 full_subdivided_num == 0 ? NULL : &subdivided_mesh.getVerticesPointer()[0].x,
+                 full_subdivided_num, VEC3_STRIDE,
+                 attributes.empty() ? NULL : &attributes[0], attributes.size());
+}
 
-    int original_texture_num = mesh.getNumTexCoords();
+void ofxButterfly::fixMeshWithNormals(ofMesh &mesh, ofMesh &subdivided_mesh, std::vector<ofVec4f> *tangents)
+{
+    GFX_PROFILE_SCOPE("fixMeshWithNormals");
     
-    // Do nothing if the user has not defined any texture coordinates.
-    if(original_texture_num == 0)
+    fixMesh(mesh, subdivided_mesh);
+    
+    int full_subdivided_num = subdivided_mesh.getNumVertices();
+    
+    if(full_subdivided_num == 0)
     {
         return;
     }
     
-    // Make sure we have a texture coordinate for every vertice in the mesh.
+    std::vector<ofVec3f> &normals = subdivided_mesh.getNormals();
+    normals.resize(full_subdivided_num);
+    
+    // fixMesh has derived the texture coordinates of every subdivided vertex if mesh has any.
+    bool with_tangents = tangents != NULL && subdivided_mesh.getNumTexCoords() == full_subdivided_num;
+    
+    if(with_tangents)
+    {
+        tangents -> resize(full_subdivided_num);
+    }
+    
+    core.ComputeNormals(&subdivided_mesh.getVerticesPointer()[0].x, VEC3_STRIDE, &normals[0].x, VEC3_STRIDE,
+                        with_tangents ? &subdivided_mesh.getTexCoordsPointer()[0].x : NULL, VEC2_STRIDE,
+                        with_tangents ? &(*tangents)[0].x : NULL, sizeof(ofVec4f)/sizeof(float));
+}
+
+void ofxButterfly::fixMeshBatch(const std::vector<ofVec3f> &poses, std::vector<ofVec3f> &subdivided_poses)
+{
+    GFX_PROFILE_SCOPE("fixMeshBatch");
     
-    int current_subdivided_texture_num = subdivided_mesh.getNumTexCoords();
-    int full_subdivided_texture_num = subdivided_mesh.getNumVertices();
+    int original_vert_num = core.NumControlVertices();
+    int full_subdivided_num = core.NumTopologyVertices();
     
-    for(int i = current_subdivided_texture_num; i < full_subdivided_texture_num; i++)
+    if(original_vert_num == 0 || poses.size() % original_vert_num != 0)
     {
-        subdivided_mesh.addTexCoord(subdivided_mesh.getVertex(i));
+        throw RuntimeError("fixMesh Error: The poses do not match the topology given to topology_start.");
     }
- 
-    // Map all original texture coordinates to the subdivided mesh.
     
-    ofVec2f * sub_textureCoords = subdivided_mesh.getTexCoordsPointer();
-    for(int i = 0; i < original_texture_num; i++)
+    int num_poses = poses.size()/original_vert_num;
+    subdivided_poses.resize((size_t)num_poses*full_subdivided_num);
+    
+    if(subdivided_poses.empty())
     {
-        sub_textureCoords[i] = mesh.getTexCoord(i);
+        return;
     }
     
-    // Derive the rest of the texture coordinates.
-    deriveTextureVertices(original_vert_num, sub_textureCoords, full_subdivided_texture_num);
+    core.FixMeshBatch(&poses[0].x, original_vert_num, VEC3_STRIDE, num_poses,
+                      &subdivided_poses[0].x, full_subdivided_num, VEC3_STRIDE);
 }
 
-// -- Private work functions.
-
-// Only called from fixMesh.
-inline void ofxButterfly::deriveVertices(int first_derived_indice, ofVec3f * vertices, int max_indice)
+void ofxButterfly::fixMesh(ofMesh &mesh, ofMesh &subdivided_mesh, const std::vector<int> &changed)
 {
-//    int max_indice = vertices.size();
+    GFX_PROFILE_SCOPE("fixMesh");
     
-    // Temporary vectors.
-    ofVec3f a1, a2, b1, b2, c1, c2, c3, c4, d1, d2;
+    int original_vert_num = mesh.getNumVertices();
+    int full_subdivided_num = subdivided_mesh.getNumVertices();
     
-    for(int i = first_derived_indice; i < max_indice; i++)
-    {
-        vector<int> inputs = transformation[i];
-        
-        int size = inputs.size();
-        
-        switch(size)
-        {
-             // Same vertex.
-            case 1: vertices[i] = vertices[inputs[0]];
-                continue;
-                
-            // Linear Interpolation.
-            case 2: vertices[i] = (vertices[inputs[0]] + vertices[inputs[1]])/2;
-                continue;
-                
-            // Boundary interpolation.
-            case 4:
-                a1 = vertices[inputs[0]];
-                a2 = vertices[inputs[1]];
-                b1 = vertices[inputs[2]];
-                b2 = vertices[inputs[3]];
-                vertices[i] = (9*a1 + 9*a2 - b1 - b2)/16.0;
-                continue;
-                
-            // Internal 6 regular butterfly subdivision.
-            case 8:
-                a1 = vertices[inputs[0]];
-                a2 = vertices[inputs[1]];
-                b1 = vertices[inputs[2]];
-                b2 = vertices[inputs[3]];
-
-                c1 = vertices[inputs[4]];
-                c2 = vertices[inputs[5]];
-                c3 = vertices[inputs[6]];
-                c4 = vertices[inputs[7]];
-
-                /*
-                d1 = vertices[inputs[8]];
-                d2 = vertices[inputs[9]];
-                */
-                 
-                // FIXME : I do not know if this is correct.
-                vertices[i] = (8*(a1 + a2) + 2*(b1 + b2) -(c1 + c2 + c3 + c4))/16.0;// + d1 + d2;
-                continue;
-                
-            default : throw new RuntimeError("Error in the topology Derivation data structures.");
-        }
-    }
+    core.FixMesh(meshPositions(mesh), original_vert_num, VEC3_STRIDE,
+                 changed.empty() ? NULL : &changed[0], changed.size(),
+                 full_subdivided_num == 0 ? NULL : &subdivided_mesh.getVerticesPointer()[0].x,
+                 full_subdivided_num, VEC3_STRIDE);
 }
 
-inline void ofxButterfly::deriveTextureVertices(int first_derived_indice, ofVec2f * vertices, int max_indice)
+void ofxButterfly::fixMeshIncremental(ofMesh &mesh, ofMesh &subdivided_mesh)
 {
-    //    int max_indice = vertices.size();
+    GFX_PROFILE_SCOPE("fixMeshIncremental");
     
-    // Temporary vectors.
-    ofVec3f a1, a2, b1, b2, c1, c2, c3, c4, d1, d2;
+    int original_vert_num = mesh.getNumVertices();
+    int full_subdivided_num = subdivided_mesh.getNumVertices();
     
-    for(int i = first_derived_indice; i < max_indice; i++)
-    {
-        vector<int> inputs = transformation[i];
-        
-        int size = inputs.size();
-        
-        switch(size)
-        {
-                // Same vertex.
-            case 1: vertices[i] = vertices[inputs[0]];
-                continue;
-                
-                // Linear Interpolation.
-            case 2: vertices[i] = (vertices[inputs[0]] + vertices[inputs[1]])/2;
-                continue;
-                
-                // Boundary interpolation.
-            case 4:
-                a1 = vertices[inputs[0]];
-                a2 = vertices[inputs[1]];
-                b1 = vertices[inputs[2]];
-                b2 = vertices[inputs[3]];
-                vertices[i] = (9*a1 + 9*a2 - b1 - b2)/16.0;
-                continue;
-                
-                // Internal 6 regular butterfly subdivision.
-            case 8:
-                a1 = vertices[inputs[0]];
-                a2 = vertices[inputs[1]];
-                b1 = vertices[inputs[2]];
-                b2 = vertices[inputs[3]];
-                
-                c1 = vertices[inputs[4]];
-                c2 = vertices[inputs[5]];
-                c3 = vertices[inputs[6]];
-                c4 = vertices[inputs[7]];
-                
-                /*
-                 d1 = vertices[inputs[8]];
-                 d2 = vertices[inputs[9]];
-                 */
-                
-                // FIXME : I do not know if this is correct.
-                vertices[i] = (8*(a1 + a2) + 2*(b1 + b2) -(c1 + c2 + c3 + c4))/16.0;// + d1 + d2;
-                continue;
-                
-            default : throw new RuntimeError("Error in the topology Derivation data structures.");
-        }
-    }
+    core.FixChangedMesh(meshPositions(mesh), original_vert_num, VEC3_STRIDE,
+                        full_subdivided_num == 0 ? NULL : &subdivided_mesh.getVerticesPointer()[0].x,
+                        full_subdivided_num, VEC3_STRIDE);
+}
+
+void ofxButterfly::setEvaluationMode(evaluation_mode evaluation)
+{
+    core.SetEvaluationMode(evaluation == EVALUATE_SIMD ? gfx::Subdivider::EVALUATE_SIMD : gfx::Subdivider::EVALUATE_SCALAR);
 }
 
+void ofxButterfly::setThreadCount(int threads)
+{
+    core.SetThreadCount(threads);
+}
 
-// FIXME : Disperse this code up to the other functions.
+void ofxButterfly::setWeldTolerance(float epsilon)
+{
+    core.SetWeldTolerance(epsilon);
+}
 
-// Performs one iteration of the subdivision.
-void ofxButterfly::subdivide(int iterations, subdivision_type type, float pixel_prescision)
+const std::vector<int> &ofxButterfly::getWeldMap() const
 {
-    // Subdivide. (Do I need to free memory???)
+    return core.WeldMap();
+}
 
-    for(int i = 0; i < iterations; i++)
-    {
-        switch(type)
-        {
-            case BUTTERFLY:
-                current_WE = current_WE.ButterflySubdivide();
-                break;
-            case LINEAR:
-                current_WE = current_WE.LinearSubdivide();
-                break;
-            case BOUNDARY:
-                current_WE = current_WE.BoundaryTrianglularSubdivide(pixel_prescision);
-                break;
-            case PASCAL:
-                current_WE = current_WE.SillyPascalSubdivide();
-                break;
-            default:
-                throw new RuntimeError("Malformed type. We do not know how to subdivide the mesh in the given way.");
-        }
-    }
-}
\ No newline at end of file
+gfx::SparseMatrix ofxButterfly::getOperator(int level, float prune)
+{
+    gfx::SparseMatrix matrix;
+    core.GetOperator(matrix, level, prune);
+    return matrix;
+}
+
+int ofxButterfly::getNumLevels() const
+{
+    return core.NumLevels();
+}
+
+const gfx::ProfileStats &ofxButterfly::getProfile() const
+{
+    return gfx::LastProfile();
+}
+
+void ofxButterfly::startTrace()
+{
+    gfx::StartTrace();
+}
+
+bool ofxButterfly::stopTrace(const std::string &path)
+{
+    return gfx::StopTrace(path.c_str());
+}
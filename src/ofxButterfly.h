@@ -21,10 +21,10 @@
 #ifndef OFXBUTTERFLY_H_
 #define OFXBUTTERFLY_H_
 
+#include <stdint.h>
 #include "ofMesh.h"
-#include "vertex.hpp"
-#include "edge.hpp"
-#include "mesh.hpp"
+#include "subdivider.hpp"
+#include "profile.hpp"
 
 class ofxButterfly
 {
@@ -44,18 +44,41 @@ public:
     ofMesh subdividePascal(ofMesh &mesh, int iterations = 1);
     ofMesh subdivideBoundary(ofMesh &mesh, float pixel_prescision, int iterations = 1);
     
+    /* Butterfly subdivision that only refines the edges whose butterfly midpoint moves more than tolerance
+     * away from the straight edge, or that are longer than max_edge_length if it is positive.
+     * Neighbouring faces are closed red green style, so the result has no cracks.
+     * max_triangles caps the triangle count, refining the largest deviations first, -1 leaves it unbounded.
+     */
+    ofMesh subdivideAdaptive(ofMesh &mesh, float tolerance, int iterations = 1,
+                             int max_triangles = -1, float max_edge_length = -1);
+    
+    /* subdivideBoundary without guessing the iterations : the boundary edges are refined, worst first,
+     * until every new boundary point moves less than pixel_prescision, in one pass over the mesh.
+     * max_vertices caps the vertex count of the result, -1 leaves it unbounded.
+     */
+    ofMesh refineBoundary(ofMesh &mesh, float pixel_prescision, int max_vertices = -1);
+    
     
     
     // -- Batch subdivision pipeline.
     
     // Prepares the given mesh for subdivision.
+    // If every vertex has a texture coordinate or a color, they are subdivided along with the vertices.
     void subdivide_start(ofMesh &mesh);
     
+    // Prepares a mesh given as raw buffers, without building an ofMesh first.
+    // positions holds num_vertices x, y, z triples, stride floats apart (3 for tightly packed positions).
+    // indices holds num_indices / 3 triangles.
+    void subdivide_start(const float *positions, int num_vertices, int stride,
+                         const uint32_t *indices, int num_indices);
+    
     // Subdivision procedures, requires trianglular meshes.
     void subdivideButterfly(int iterations = 1);
     void subdivideLinear   (int iterations = 1);
     void subdividePascal   (int iterations = 1);
     void subdivideBoundary (float pixel_prescision, int iterations = 1);
+    void subdivideAdaptive (float tolerance, int iterations = 1, int max_triangles = -1, float max_edge_length = -1);
+    void refineBoundary    (float pixel_prescision, int max_vertices = -1);
     
     // Ends the current subdivision.
     ofMesh subdivide_end();
@@ -63,9 +86,14 @@ public:
     // -- Fast algorithms for repeatedly computing subdivisions of meshes with the same topology.
     
     // Gives ofxButterfly a mesh with a particular topology.
+    // Texture coordinates and colors are carried along as by subdivide_start.
     // REQUIRES : mesh should be made of triangles.
     void topology_start(ofMesh &mesh);
     
+    // Same as subdivide_start, for raw buffers.
+    void topology_start(const float *positions, int num_vertices, int stride,
+                        const uint32_t *indices, int num_indices);
+    
     /* Topology subdivision routines.
      * REQUIRES : topology_start should have been called.
      * ENSURES :
@@ -84,7 +112,38 @@ public:
  
     
     // Returns the mesh that is the result of all of the topology_subdivide_ calls.
-    ofMesh topology_end();
+    // With compose, fixMesh derives every vertex straight from the original vertices with one combined stencil
+    // instead of going through every level. Weights of at most prune are dropped, and the results may differ
+    // slightly from the level by level evaluation.
+    ofMesh topology_end(bool compose = false, float prune = 1e-6f);
+    
+    /* Saves the topology compiled by topology_end to a binary file, so later runs can skip the subdivision.
+     * topology_load replaces topology_start, the topology_subdivide_ calls and topology_end with the saved file,
+     * where schemes lists the scheme of every topology_subdivide_ iteration in order.
+     * It returns false if the file is missing, or was saved for other faces, schemes or versions of ofxButterfly,
+     * and the topology then has to be built as usual. On success subdivided_mesh is set to the mesh that
+     * topology_end would have returned. A loaded topology can not be subdivided further.
+     */
+    void topology_save(const std::string &path);
+    bool topology_load(const std::string &path, ofMesh &mesh,
+                       const std::vector<gfx::Subdivider::Scheme> &schemes, ofMesh &subdivided_mesh);
+    
+    /* Once setTopologyCacheBudget has given it a budget, every topology_end also keeps the compiled topology
+     * in a cache of recently used topologies, so an app can switch between several meshes without subdividing them again.
+     * topology_cached makes a cached topology current, like topology_load does from a file.
+     * fixMeshCached picks the cached topology that matches the index buffer of mesh and the size of subdivided_mesh,
+     * and throws if there is none, instead of relying on the REQUIRES of fixMesh. The current topology is kept if it matches,
+     * otherwise it also throws if several cached topologies match, as the same levels of different schemes do,
+     * topology_cached with the schemes chooses between them.
+     * The least recently used topologies are dropped once the cache exceeds its budget in bytes.
+     * The budget is 0 by default, which disables the cache.
+     */
+    bool topology_cached(ofMesh &mesh, const std::vector<gfx::Subdivider::Scheme> &schemes, ofMesh &subdivided_mesh);
+    void fixMeshCached(ofMesh &mesh, ofMesh &subdivided_mesh);
+    void setTopologyCacheBudget(size_t bytes);
+    
+    // The budget, size and hit and miss counts of the cache.
+    const gfx::TopologyCache &getTopologyCache() const;
     
     /* fixMesh
      * REQUIRES : mesh should have the same topology as the mesh sent to the previous call of topology_start.
@@ -95,34 +154,82 @@ public:
      *            the vertices present in subdivided_mesh that have been changed in mesh will be updated to the new mesh locations.
      *            We will use the mapping constructed in the caching function() to compute the new locations for the subdivision
      *            vertices and fix their locations.
+     *            The texture coordinates and colors of mesh are derived in the same pass over the mapping.
      */
     void fixMesh(ofMesh &mesh, ofMesh &subdivided_mesh);
     
-private:
-    
-    // Subdivision routines.
-    enum subdivision_type {BUTTERFLY, LINEAR, BOUNDARY, PASCAL};
-    void subdivide(int iterations, subdivision_type type, float pixel_prescision = -1);
-    
-    inline void deriveVertices(int first_derived_indice, ofVec3f * vertices, int max_indice);
-    inline void deriveTextureVertices(int first_derived_indice, ofVec2f * vertices, int max_indice);
+    /* fixMesh that also sets the smooth normals of subdivided_mesh, so it is ready to render without a separate
+     * normals pass. The faces around every subdivided vertex are listed once per topology and reused by every call.
+     * If tangents is not NULL and mesh has texture coordinates, tangents receives x, y, z, w for every subdivided vertex,
+     * with w = -1 where the texture is mirrored, for normal mapping.
+     */
+    void fixMeshWithNormals(ofMesh &mesh, ofMesh &subdivided_mesh, std::vector<ofVec4f> *tangents = NULL);
     
-    // -- Subdivision data structures.
+    /* fixMesh for many poses of the mesh at once, such as animation frames or instances.
+     * poses holds the vertices of every pose one after another, subdivided_poses is resized to hold the subdivided
+     * vertices of every pose one after another. Each stencil is read once for several poses, which is faster than
+     * a fixMesh call per pose and gives the same vertices. Texture coordinates are not derived.
+     */
+    void fixMeshBatch(const std::vector<ofVec3f> &poses, std::vector<ofVec3f> &subdivided_poses);
+    
+    /* Incremental fixMesh for meshes where only a few vertices move at a time.
+     * Only the subdivided vertices that depend on the changed vertices of mesh are recomputed.
+     * The first form takes the indices of the changed vertices, the second finds them by comparing mesh with
+     * the vertices of the previous fixMesh call, and updates everything on its first call after topology_end.
+     * REQUIRES : subdivided_mesh holds the result of an earlier fixMesh call.
+     * Texture coordinates are left as they are.
+     */
+    void fixMesh(ofMesh &mesh, ofMesh &subdivided_mesh, const std::vector<int> &changed);
+    void fixMeshIncremental(ofMesh &mesh, ofMesh &subdivided_mesh);
     
-    // A map from vertices to mesh indices.
-    std::map<gfx::Vertex, int> map_vertice_index;
+    /* The linear map that fixMesh applies, with the subdivided vertices as rows and float weights.
+     * level -1 composes every topology_subdivide_ iteration, so the columns are the vertices of the topology_start mesh.
+     * level i gives only the i'th iteration, whose columns are the vertices before it.
+     * The matrix is in CSR form, operator.RowIndices(rows) gives the rows of the COO form.
+     */
+    gfx::SparseMatrix getOperator(int level = -1, float prune = 0);
+    int getNumLevels() const;
+    
+    // How fixMesh evaluates the stencils.
+    // EVALUATE_SIMD batches them into vector kernels picked for the running processor,
+    // EVALUATE_SCALAR walks the stencil table row by row. Both give identical results.
+    // Meshes with texture coordinates, colors or other attributes always walk the table, in one pass over the positions and
+    // every attribute, whose channels already fill the vector registers of the table's kernels.
+    enum evaluation_mode {EVALUATE_SCALAR, EVALUATE_SIMD};
+    void setEvaluationMode(evaluation_mode evaluation);
+    
+    // The number of threads that the butterfly, linear and pascal subdivisions spread their faces over,
+    // and that fixMesh spreads the vertices of each subdivision level over.
+    // 0 uses every hardware thread, which is the default. 1 works on the calling thread.
+    void setThreadCount(int threads);
+    
+    // Vertices of the meshes given to subdivide_start and topology_start that are closer than epsilon are welded together,
+    // so split or nearly duplicated vertices do not open seams in the subdivision. 0 only welds identical positions.
+    // Every original vertex keeps its index, getWeldMap()[i] is the vertex that the faces use instead of i.
+    void setWeldTolerance(float epsilon);
+    const std::vector<int> &getWeldMap() const;
+    
+    // The phase and level timings of the last subdivision, topology_end or fixMesh call on this thread.
+    // They are only recorded when the addon is compiled with GFX_PROFILE defined, otherwise the events stay empty.
+    const gfx::ProfileStats &getProfile() const;
+    
+    // Collects the timings of every call until stopTrace, which writes them as Chrome trace event JSON.
+    void startTrace();
+    bool stopTrace(const std::string &path);
     
-    // A map from mesh indices to vertices.
-    std::map<int, gfx::Vertex> map_index_vertice;
+private:
     
-    // The current windged edge structure.
-    gfx::WingedEdge current_WE;
+    // The openFrameworks free subdivision engine, this class converts between it and ofMeshes.
+    gfx::Subdivider core;
     
-    // An mapping that maps indices in a subdivided mesh to the indices in a defored mesh needed to derive its position.
-    std::map<int, std::vector<int> > transformation;
+    // The compiled topologies of the recent topology_end calls.
+    gfx::TopologyCache topologies;
     
+    // The core attributes of the texture coordinates and colors of the current mesh, -1 if it has none.
+    int texcoord_attribute;
+    int color_attribute;
     
-    void topology_subdivide(subdivision_type type);
+    void addAttributes(ofMesh &mesh);
     
 };
 
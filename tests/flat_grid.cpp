@@ -0,0 +1,138 @@
+/* Checks that one butterfly level keeps a flat regular grid flat and evenly spaced.
+ *
+ * Every new vertex of a grid of unit squares, split along parallel diagonals, is compared with its edge midpoint,
+ * which the LINEAR scheme gives at the same index. Interior edges, including those next to the boundary,
+ * must land on their midpoints. So must boundary edges, except the two next to every corner, where the 4 point
+ * rule reaches around the right angle and rounds it by 1/16 of the sum of the two corner edges,
+ * sqrt(2)/16 of an edge on the untilted grid.
+ *
+ * The grid is checked flat in the xy plane and tilted out of it. Returns 0 if every vertex passes.
+ */
+#include <stdint.h>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "subdivider.hpp"
+
+using namespace gfx;
+
+static const int   GRID      = 6;
+static const float TOLERANCE = 1e-5f;
+
+// A grid of GRID by GRID unit squares in the plane z = tilt_x x + tilt_y y.
+static void gridMesh(float tilt_x, float tilt_y, std::vector<float> &positions, std::vector<uint32_t> &indices)
+{
+    for(int j = 0; j <= GRID; j++)
+    {
+        for(int i = 0; i <= GRID; i++)
+        {
+            positions.push_back(i);
+            positions.push_back(j);
+            positions.push_back(tilt_x*i + tilt_y*j);
+        }
+    }
+
+    for(int j = 0; j < GRID; j++)
+    {
+        for(int i = 0; i < GRID; i++)
+        {
+            uint32_t a = j*(GRID + 1) + i;
+            uint32_t b = a + 1;
+            uint32_t c = a + GRID + 1;
+            uint32_t d = c + 1;
+
+            uint32_t triangles[6] = {a, b, c, b, d, c};
+            indices.insert(indices.end(), triangles, triangles + 6);
+        }
+    }
+}
+
+static void subdivide(Subdivider::Scheme scheme, const std::vector<float> &positions, const std::vector<uint32_t> &indices,
+                      std::vector<float> &subdivided, std::vector<uint32_t> &triangles)
+{
+    Subdivider core;
+    core.SubdivideStart(&positions[0], positions.size()/3, 3, &indices[0], indices.size());
+    core.Subdivide(scheme);
+
+    int num_vertices, num_indices;
+    core.GetMeshSize(num_vertices, num_indices);
+
+    subdivided.resize(3*num_vertices);
+    triangles.resize(num_indices);
+    core.GetMesh(&subdivided[0], 3, &triangles[0]);
+}
+
+/* The expected distance of the new vertex from the midpoint at x, y of the grid : 0, unless the midpoint lies
+ * on the boundary half an edge away from a corner. The 4 point rule there pulls it by 1/16 of the two edges
+ * leaving the corner, which point into the grid.
+ */
+static float expectedOffset(float x, float y, float tilt_x, float tilt_y)
+{
+    bool end_x = x == 0.5f || x == GRID - 0.5f;
+    bool end_y = y == 0.5f || y == GRID - 0.5f;
+    bool side_x = x == 0 || x == GRID;
+    bool side_y = y == 0 || y == GRID;
+
+    if(!(end_x && side_y) && !(end_y && side_x))
+    {
+        return 0;
+    }
+
+    float dx = x < GRID/2 ? 1 : -1;
+    float dy = y < GRID/2 ? 1 : -1;
+    float dz = tilt_x*dx + tilt_y*dy;
+
+    return std::sqrt(dx*dx + dy*dy + dz*dz)/16;
+}
+
+static int checkGrid(float tilt_x, float tilt_y)
+{
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+    gridMesh(tilt_x, tilt_y, positions, indices);
+
+    std::vector<float> butterfly, midpoints;
+    std::vector<uint32_t> butterfly_triangles, midpoint_triangles;
+    subdivide(Subdivider::BUTTERFLY, positions, indices, butterfly, butterfly_triangles);
+    subdivide(Subdivider::LINEAR, positions, indices, midpoints, midpoint_triangles);
+
+    if(butterfly_triangles != midpoint_triangles)
+    {
+        std::printf("flat_grid : the butterfly and linear levels number their vertices differently.\n");
+        return 1;
+    }
+
+    int num_control  = positions.size()/3;
+    int num_vertices = midpoints.size()/3;
+    int failures = 0;
+
+    for(int v = num_control; v < num_vertices; v++)
+    {
+        const float *p = &butterfly[3*v];
+        const float *m = &midpoints[3*v];
+
+        float dx = p[0] - m[0];
+        float dy = p[1] - m[1];
+        float dz = p[2] - m[2];
+        float offset = std::sqrt(dx*dx + dy*dy + dz*dz);
+
+        float expected = expectedOffset(m[0], m[1], tilt_x, tilt_y);
+
+        if(std::fabs(offset - expected) > TOLERANCE)
+        {
+            std::printf("flat_grid : tilt %g %g, the vertex at %g %g is %g from its edge midpoint, expected %g.\n",
+                        tilt_x, tilt_y, m[0], m[1], offset, expected);
+            failures++;
+        }
+    }
+
+    std::printf("flat_grid : tilt %g %g, %d of %d new vertices checked, %d failed.\n",
+                tilt_x, tilt_y, num_vertices - num_control, num_vertices - num_control, failures);
+    return failures;
+}
+
+int main()
+{
+    int failures = checkGrid(0, 0) + checkGrid(0.3f, -0.2f);
+    return failures == 0 ? 0 : 1;
+}